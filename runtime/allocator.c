@@ -0,0 +1,47 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  allocator.c
+
+  The default allocator; see allocator.h.
+
+*********************************************************************/
+
+#include <stdlib.h>
+
+#include "gazelle/allocator.h"
+
+static
+void *default_alloc(struct gzl_allocator *a, size_t size)
+{
+    return malloc(size);
+}
+
+static
+void *default_realloc(struct gzl_allocator *a, void *ptr, size_t old_size,
+                      size_t new_size)
+{
+    return realloc(ptr, new_size);
+}
+
+static
+void default_free(struct gzl_allocator *a, void *ptr, size_t size)
+{
+    free(ptr);
+}
+
+struct gzl_allocator gzl_default_allocator = {
+    default_alloc,
+    default_realloc,
+    default_free
+};
+
+/*
+ * Local Variables:
+ * c-file-style: "bsd"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:et:sts=4:sw=4
+ */
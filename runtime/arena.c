@@ -0,0 +1,78 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  arena.c
+
+  A simple bump allocator; see arena.h.
+
+*********************************************************************/
+
+#include "gazelle/arena.h"
+
+struct gzl_arena_chunk
+{
+    struct gzl_arena_chunk *prev;
+    size_t size;
+    size_t used;
+};
+
+/* The chunk header is padded so that the data after it stays aligned. */
+#define CHUNK_HEADER_SIZE \
+    ((sizeof(struct gzl_arena_chunk) + GZL_ARENA_ALIGN - 1) & \
+     ~(size_t)(GZL_ARENA_ALIGN - 1))
+
+void gzl_arena_init(struct gzl_arena *arena, size_t initial_chunk_size,
+                    struct gzl_allocator *allocator)
+{
+    arena->chunk = NULL;
+    arena->chunk_size = initial_chunk_size;
+    arena->allocator = allocator;
+}
+
+void *gzl_arena_alloc(struct gzl_arena *arena, size_t size)
+{
+    size = (size + GZL_ARENA_ALIGN - 1) & ~(size_t)(GZL_ARENA_ALIGN - 1);
+
+    struct gzl_arena_chunk *chunk = arena->chunk;
+    if(chunk == NULL || chunk->size - chunk->used < size)
+    {
+        while(arena->chunk_size < size)
+            arena->chunk_size *= 2;
+        chunk = arena->allocator->alloc(arena->allocator,
+                                        CHUNK_HEADER_SIZE + arena->chunk_size);
+        if(chunk == NULL)
+            return NULL;
+        chunk->prev = arena->chunk;
+        chunk->size = arena->chunk_size;
+        chunk->used = 0;
+        arena->chunk = chunk;
+        arena->chunk_size *= 2;
+    }
+
+    void *mem = (char*)chunk + CHUNK_HEADER_SIZE + chunk->used;
+    chunk->used += size;
+    return mem;
+}
+
+void gzl_arena_free(struct gzl_arena *arena)
+{
+    struct gzl_arena_chunk *chunk = arena->chunk;
+    while(chunk)
+    {
+        struct gzl_arena_chunk *prev = chunk->prev;
+        arena->allocator->free(arena->allocator, chunk,
+                               CHUNK_HEADER_SIZE + chunk->size);
+        chunk = prev;
+    }
+    arena->chunk = NULL;
+}
+
+/*
+ * Local Variables:
+ * c-file-style: "bsd"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:et:sts=4:sw=4
+ */
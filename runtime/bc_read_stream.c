@@ -27,11 +27,13 @@
 
 #define BLOCKINFO_BLOCK_SETBID 1
 
-#define RESIZE_ARRAY_IF_NECESSARY(ptr, size, desired_size) \
+#define RESIZE_ARRAY_IF_NECESSARY(stream, ptr, size, desired_size) \
     if(size < desired_size) \
     { \
+        ptr = stream->allocator->realloc(stream->allocator, ptr, \
+                                         size*sizeof(*ptr), \
+                                         size*2*sizeof(*ptr)); \
         size *= 2; \
-        ptr = realloc(ptr, size*sizeof(*ptr)); \
     }
 
 #include <stdio.h>
@@ -137,6 +139,8 @@ struct bc_read_stream
     int blockinfo_size;
     int blockinfo_len;
     struct blockinfo *blockinfos;
+
+    struct gzl_allocator *allocator;
 };
 
 /*
@@ -189,17 +193,29 @@ void dump_blockinfo(struct blockinfo *bi)
 */
 
 static int refill_next_bits(struct bc_read_stream *stream);
-struct bc_read_stream *bc_read_stream_init();
+struct bc_read_stream *bc_read_stream_init(struct gzl_allocator *allocator);
 
 struct bc_read_stream *bc_rs_open_mem(const char *data)
 {
-    struct bc_read_stream *stream = bc_read_stream_init();
+    return bc_rs_open_mem_with_allocator(data, &gzl_default_allocator);
+}
+
+struct bc_read_stream *bc_rs_open_mem_with_allocator(
+    const char *data, struct gzl_allocator *allocator)
+{
+    struct bc_read_stream *stream = bc_read_stream_init(allocator);
     stream->inmem = (unsigned char *)data;
     refill_next_bits(stream);
     return stream;
 }
 
 struct bc_read_stream *bc_rs_open_file(const char *filename)
+{
+    return bc_rs_open_file_with_allocator(filename, &gzl_default_allocator);
+}
+
+struct bc_read_stream *bc_rs_open_file_with_allocator(
+    const char *filename, struct gzl_allocator *allocator)
 {
     FILE *infile = fopen(filename, "r");
 
@@ -216,17 +232,18 @@ struct bc_read_stream *bc_rs_open_file(const char *filename)
         return NULL;
     }
 
-    struct bc_read_stream *stream = bc_read_stream_init();
+    struct bc_read_stream *stream = bc_read_stream_init(allocator);
     stream->infile = infile;
     refill_next_bits(stream);
     return stream;
 }
 
-struct bc_read_stream *bc_read_stream_init()
+struct bc_read_stream *bc_read_stream_init(struct gzl_allocator *allocator)
 {
     /* TODO: give the application a way to get the app-specific magic number */
 
-    struct bc_read_stream *stream = malloc(sizeof(*stream));
+    struct bc_read_stream *stream = allocator->alloc(allocator, sizeof(*stream));
+    stream->allocator = allocator;
     stream->infile = NULL;
     stream->stream_err = 0;
 
@@ -238,7 +255,7 @@ struct bc_read_stream *bc_read_stream_init()
     stream->num_abbrevs = 0;
 
     stream->stream_stack_size = 8;  /* enough for a few levels of nesting and a few abbrevs */
-    stream->stream_stack      = malloc(stream->stream_stack_size*sizeof(*stream->stream_stack));
+    stream->stream_stack      = allocator->alloc(allocator, stream->stream_stack_size*sizeof(*stream->stream_stack));
 
     /* we create an outermose stack frame -- this exists mostly to store
      * the abbrev length of the outermost scope, and to store a bogus
@@ -253,41 +270,44 @@ struct bc_read_stream *bc_read_stream_init()
 
     stream->abbrev_operands_size = 8;
     stream->abbrev_operands_len  = 0;
-    stream->abbrev_operands = malloc(stream->abbrev_operands_size*sizeof(*stream->abbrev_operands));
+    stream->abbrev_operands = allocator->alloc(allocator, stream->abbrev_operands_size*sizeof(*stream->abbrev_operands));
 
     stream->blockinfo_size = 8;
     stream->blockinfo_len  = 0;
-    stream->blockinfos = malloc(stream->blockinfo_size*sizeof(*stream->blockinfos));
+    stream->blockinfos = allocator->alloc(allocator, stream->blockinfo_size*sizeof(*stream->blockinfos));
 
     stream->record_buf_size = 8;
-    stream->record_buf = malloc(stream->record_buf_size*sizeof(*stream->record_buf));
+    stream->record_buf = allocator->alloc(allocator, stream->record_buf_size*sizeof(*stream->record_buf));
 
     stream->record_size_abbrev = 8;
-    stream->record_abbrev_operands = malloc(stream->record_size_abbrev*sizeof(*stream->record_abbrev_operands));
+    stream->record_abbrev_operands = allocator->alloc(allocator, stream->record_size_abbrev*sizeof(*stream->record_abbrev_operands));
 
     return stream;
 }
 
 void bc_rs_close_stream(struct bc_read_stream *stream)
 {
-    free(stream->record_abbrev_operands);
-    free(stream->record_buf);
-    free(stream->abbrev_operands);
-    free(stream->stream_stack);
+    struct gzl_allocator *a = stream->allocator;
+    a->free(a, stream->record_abbrev_operands, stream->record_size_abbrev*sizeof(*stream->record_abbrev_operands));
+    a->free(a, stream->record_buf, stream->record_buf_size*sizeof(*stream->record_buf));
+    a->free(a, stream->abbrev_operands, stream->abbrev_operands_size*sizeof(*stream->abbrev_operands));
+    a->free(a, stream->stream_stack, stream->stream_stack_size*sizeof(*stream->stream_stack));
 
     for(int i = 0; i < stream->blockinfo_len; i++)
     {
-        for(int j = 0; j < stream->blockinfos[i].num_abbreviations; j++)
+        struct blockinfo *bi = &stream->blockinfos[i];
+        for(int j = 0; j < bi->num_abbreviations; j++)
         {
-            free(stream->blockinfos[i].abbreviations[j].operands);
+            a->free(a, bi->abbreviations[j].operands,
+                    bi->abbreviations[j].num_operands*sizeof(*bi->abbreviations[j].operands));
         }
-        free(stream->blockinfos[i].abbreviations);
+        a->free(a, bi->abbreviations, bi->size_abbreviations*sizeof(*bi->abbreviations));
     }
-    free(stream->blockinfos);
+    a->free(a, stream->blockinfos, stream->blockinfo_size*sizeof(*stream->blockinfos));
 
     if(stream->infile)
         fclose(stream->infile);
-    free(stream);
+    a->free(a, stream, sizeof(*stream));
 }
 
 uint64_t bc_rs_read_64(struct bc_read_stream *stream, int i)
@@ -484,7 +504,7 @@ static uint64_t read_abbrev_value(struct bc_read_stream *stream, struct abbrev_o
 
 static void append_value(struct bc_read_stream *stream, uint64_t val)
 {
-    RESIZE_ARRAY_IF_NECESSARY(stream->record_buf, stream->record_buf_size, stream->current_record_size+1);
+    RESIZE_ARRAY_IF_NECESSARY(stream, stream->record_buf, stream->record_buf_size, stream->current_record_size+1);
     stream->record_buf[stream->current_record_size++] = val;
 }
 
@@ -576,14 +596,14 @@ struct blockinfo *find_or_create_blockinfo(struct bc_read_stream *stream, int bl
     }
     else
     {
-        RESIZE_ARRAY_IF_NECESSARY(stream->blockinfos, stream->blockinfo_size, stream->blockinfo_len+1);
+        RESIZE_ARRAY_IF_NECESSARY(stream, stream->blockinfos, stream->blockinfo_size, stream->blockinfo_len+1);
 
         struct blockinfo *new_bi = &stream->blockinfos[stream->blockinfo_len++];
 
         new_bi->block_id = block_id;
         new_bi->num_abbreviations = 0;
         new_bi->size_abbreviations = 8;
-        new_bi->abbreviations = malloc(new_bi->size_abbreviations * sizeof(*new_bi->abbreviations));
+        new_bi->abbreviations = stream->allocator->alloc(stream->allocator, new_bi->size_abbreviations * sizeof(*new_bi->abbreviations));
 
         return new_bi;
     }
@@ -637,7 +657,7 @@ void bc_rs_next_record(struct bc_read_stream *stream)
             stream->block_len = read_fixed(stream, 32);
             stream->record_type = StartBlock;
 
-            RESIZE_ARRAY_IF_NECESSARY(stream->stream_stack, stream->stream_stack_size,
+            RESIZE_ARRAY_IF_NECESSARY(stream, stream->stream_stack, stream->stream_stack_size,
                                       stream->stream_stack_len+1);
 
             stream->block_metadata = &stream->stream_stack[stream->stream_stack_len++];
@@ -656,7 +676,7 @@ void bc_rs_next_record(struct bc_read_stream *stream)
             stream->record_type = DefineAbbrev;
             stream->record_num_abbrev = read_vbr(stream, 5);
 
-            RESIZE_ARRAY_IF_NECESSARY(stream->record_abbrev_operands, stream->record_size_abbrev,
+            RESIZE_ARRAY_IF_NECESSARY(stream, stream->record_abbrev_operands, stream->record_size_abbrev,
                                       stream->record_num_abbrev);
 
             for(int i = 0; i < stream->record_num_abbrev; i++)
@@ -672,7 +692,7 @@ void bc_rs_next_record(struct bc_read_stream *stream)
 
             stream->current_record_size = read_vbr(stream, 6);
 
-            RESIZE_ARRAY_IF_NECESSARY(stream->record_buf, stream->record_buf_size,
+            RESIZE_ARRAY_IF_NECESSARY(stream, stream->record_buf, stream->record_buf_size,
                                       stream->current_record_size+1);
 
             for(int i = 0; i < stream->current_record_size; i++)
@@ -718,9 +738,9 @@ struct record_info bc_rs_next_data_record(struct bc_read_stream *stream)
         {
             int num_ops = stream->record_num_abbrev;
 
-            RESIZE_ARRAY_IF_NECESSARY(stream->stream_stack, stream->stream_stack_size,
+            RESIZE_ARRAY_IF_NECESSARY(stream, stream->stream_stack, stream->stream_stack_size,
                                       stream->stream_stack_len+1);
-            RESIZE_ARRAY_IF_NECESSARY(stream->abbrev_operands, stream->abbrev_operands_size,
+            RESIZE_ARRAY_IF_NECESSARY(stream, stream->abbrev_operands, stream->abbrev_operands_size,
                                       stream->abbrev_operands_len+num_ops+1);
 
             struct stream_stack_entry *e = &stream->stream_stack[stream->stream_stack_len++];
@@ -775,12 +795,12 @@ struct record_info bc_rs_next_data_record(struct bc_read_stream *stream)
                         stream->stream_err |= BITCODE_ERR_CORRUPT_INPUT;
                     }
 
-                    RESIZE_ARRAY_IF_NECESSARY(bi->abbreviations,
+                    RESIZE_ARRAY_IF_NECESSARY(stream, bi->abbreviations,
                                               bi->size_abbreviations, bi->num_abbreviations+1);
 
                     struct blockinfo_abbrev *abbrev = &bi->abbreviations[bi->num_abbreviations++];
                     abbrev->num_operands = stream->record_num_abbrev;
-                    abbrev->operands = malloc(sizeof(*abbrev->operands) * abbrev->num_operands);
+                    abbrev->operands = stream->allocator->alloc(stream->allocator, sizeof(*abbrev->operands) * abbrev->num_operands);
                     for(int i = 0; i < abbrev->num_operands; i++)
                         abbrev->operands[i] = stream->record_abbrev_operands[i];
                 }
@@ -0,0 +1,56 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  allocator.h
+
+  An interface through which the runtime allocates all of its memory,
+  so that clients can supply their own allocators.  The grammar loader,
+  the bitcode reader, parse states, parse state pools and line indexes
+  each take one; everything that does not is allocated with
+  gzl_default_allocator.
+
+*********************************************************************/
+
+#ifndef GAZELLE_ALLOCATOR
+#define GAZELLE_ALLOCATOR
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* The functions behave like malloc(), realloc() and free(), except that the
+ * runtime always passes the size that a block was allocated with, which saves
+ * allocators from having to record it, and lets them account for every byte.
+ * realloc() is never given a NULL pointer, but like the C function, free() may
+ * be.
+ *
+ * To give an allocator state of its own, embed this struct at the beginning
+ * of a larger one, and cast the pointer the functions are given. */
+struct gzl_allocator
+{
+    void *(*alloc)(struct gzl_allocator *a, size_t size);
+    void *(*realloc)(struct gzl_allocator *a, void *ptr, size_t old_size,
+                     size_t new_size);
+    void (*free)(struct gzl_allocator *a, void *ptr, size_t size);
+};
+
+/* Uses malloc(), realloc() and free(). */
+extern struct gzl_allocator gzl_default_allocator;
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* GAZELLE_ALLOCATOR */
+
+/*
+ * Local Variables:
+ * c-file-style: "bsd"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:et:sts=4:sw=4
+ */
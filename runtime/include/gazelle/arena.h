@@ -0,0 +1,56 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  arena.h
+
+  A simple bump allocator.  Memory is carved sequentially out of large
+  chunks, so that objects allocated together sit next to each other in
+  memory, and is only ever freed all at once.
+
+*********************************************************************/
+
+#ifndef GAZELLE_ARENA
+#define GAZELLE_ARENA
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "gazelle/allocator.h"
+
+/* Every allocation is aligned to this many bytes. */
+#define GZL_ARENA_ALIGN 16
+
+struct gzl_arena_chunk;
+
+struct gzl_arena
+{
+    struct gzl_arena_chunk *chunk;  /* newest first; NULL if empty */
+    size_t chunk_size;  /* the size of the next chunk; doubles each time */
+    struct gzl_allocator *allocator;  /* where the chunks come from */
+};
+
+void gzl_arena_init(struct gzl_arena *arena, size_t initial_chunk_size,
+                    struct gzl_allocator *allocator);
+void *gzl_arena_alloc(struct gzl_arena *arena, size_t size);
+
+/* Frees all memory allocated from the arena, leaving it empty. */
+void gzl_arena_free(struct gzl_arena *arena);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  /* GAZELLE_ARENA */
+
+/*
+ * Local Variables:
+ * c-file-style: "bsd"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:et:sts=4:sw=4
+ */
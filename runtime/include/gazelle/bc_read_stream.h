@@ -15,6 +15,8 @@
 
 #include <stdint.h>
 
+#include "gazelle/allocator.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -31,6 +33,13 @@ struct bc_read_stream *bc_rs_open_file(const char *filename);
 struct bc_read_stream *bc_rs_open_mem(const char *data);
 void bc_rs_close_stream(struct bc_read_stream *stream);
 
+/* The same, but allocating the stream's memory from the given allocator
+ * instead of gzl_default_allocator. */
+struct bc_read_stream *bc_rs_open_file_with_allocator(
+    const char *filename, struct gzl_allocator *allocator);
+struct bc_read_stream *bc_rs_open_mem_with_allocator(
+    const char *data, struct gzl_allocator *allocator);
+
 /**********************************************************
 
   Moving around the stream
@@ -26,6 +26,26 @@
 #define FREE_DYNARRAY(name) \
   free(name);
 
+/* The same, but allocating from a struct gzl_allocator (see allocator.h). */
+#define RESIZE_DYNARRAY_WITH(name, desired_len, allocator) { \
+  int orig_size = name ## _size; \
+  while(name ## _size < (desired_len)) \
+    name ## _size *= 2; \
+  if(name ## _size != orig_size) \
+    name = (allocator)->realloc((allocator), name, \
+                                orig_size * sizeof(*name), \
+                                name ## _size * sizeof(*name)); \
+  name ## _len = desired_len; \
+}
+
+#define INIT_DYNARRAY_WITH(name, initial_len, initial_size, allocator) \
+  name ## _len = initial_len; \
+  name ## _size = initial_size; \
+  name = (allocator)->alloc((allocator), name ## _size * sizeof(*name))
+
+#define FREE_DYNARRAY_WITH(name, allocator) \
+  (allocator)->free((allocator), name, name ## _size * sizeof(*name));
+
 #define DYNARRAY_GET_TOP(name) \
   (&name[name ## _len - 1])
 
@@ -12,6 +12,11 @@
   A compiled Gazelle grammar consists of a bunch of state machines of
   various kinds -- see the manual for more details.
 
+  The loader allocates the state machines together from one arena and
+  the names from another, so the parser's working set stays dense.
+  Within each struct, the fields the parser reads come first and names
+  last.
+
 *********************************************************************/
 
 #ifndef GAZELLE_GRAMMAR
@@ -22,6 +27,24 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gazelle/arena.h"
+
+/* Finds the transition that an RTN or GLA state takes on a given terminal ID.
+ * Built at load time.  States with at least GZL_DENSE_DISPATCH_MIN_TERMINALS
+ * distinct terminals get a table indexed directly by terminal ID; the others
+ * get a table sorted by terminal ID, which is scanned.  Offsets index
+ * the state's transitions, and are -1 for terminals with no transition. */
+#define GZL_DENSE_DISPATCH_MIN_TERMINALS 8
+struct gzl_terminal_dispatch
+{
+    bool dense;
+    int len;            /* num_terminals if dense, else number of entries */
+    int *terminal_ids;  /* NULL if dense */
+    int *offsets;
+};
 
 /*
  * RTN
@@ -48,6 +71,7 @@ struct gzl_rtn_transition
       GZL_TERMINAL_TRANSITION,
       GZL_NONTERM_TRANSITION,
     } transition_type;
+    int terminal_id;  /* only for GZL_TERMINAL_TRANSITION */
 
     union {
       char            *terminal_name;
@@ -55,8 +79,8 @@ struct gzl_rtn_transition
     } edge;
 
     struct gzl_rtn_state *dest_state;
-    char *slotname;
     int slotnum;
+    char *slotname;
 };
 
 struct gzl_rtn_state
@@ -76,6 +100,19 @@ struct gzl_rtn_state
 
     int num_transitions;
     struct gzl_rtn_transition *transitions;
+    struct gzl_rtn *rtn;  /* the RTN this state belongs to */
+
+    /* Covers only terminal transitions. */
+    struct gzl_terminal_dispatch dispatch;
+
+    /* For GZL_STATE_HAS_NEITHER states, the stack operations that lead from
+     * here to a state with an IntFA or GLA, computed at load time.  Each step
+     * is a nonterminal transition to push, or NULL to pop a frame that an
+     * earlier step pushed.  descent_depth is the most frames the steps have
+     * pushed at any one time. */
+    int num_descent_steps;
+    struct gzl_rtn_transition **descent_steps;
+    int descent_depth;
 };
 
 /*
@@ -92,12 +129,20 @@ struct gzl_gla
 
     int num_transitions;
     struct gzl_gla_transition *transitions;
+
+    /* Set if every transition out of the start state leads to a final state,
+     * ie. the GLA decides on its first terminal alone.  ll1_dispatch then maps
+     * each terminal straight to the transition_offset of that final state, so
+     * the parser can take the decision without pushing a GLA frame. */
+    bool is_ll1;
+    struct gzl_terminal_dispatch ll1_dispatch;
 };
 
 struct gzl_gla_transition
 {
-    char *term;  /* if NULL, then the term is EOF */
+    int term_id;
     struct gzl_gla_state *dest_state;
+    char *term;  /* if NULL, then the term is EOF */
 };
 
 struct gzl_gla_state
@@ -109,6 +154,7 @@ struct gzl_gla_state
             struct gzl_intfa *intfa;
             int num_transitions;
             struct gzl_gla_transition *transitions;
+            struct gzl_terminal_dispatch dispatch;  /* includes EOF */
         } nonfinal;
 
         struct gzl_final_info {
@@ -131,6 +177,34 @@ struct gzl_intfa
 
     int num_transitions;
     struct gzl_intfa_transition *transitions;
+
+    /* Bytes that every state treats identically share an equivalence class.
+     * byte_class maps each input byte to its class, and each state's
+     * next_state table has one entry per class.  byte_class is NULL if this
+     * IntFA has no tables. */
+    int num_classes;
+    uint8_t *byte_class;
+
+    /* Storage for byte_class and all of the next_state tables, or NULL. */
+    uint8_t *tables;
+};
+
+/* Marks a byte with no transition in an IntFA state's next_state table. */
+#define GZL_INTFA_NO_TRANSITION 0xFF
+
+/* Describes the bytes on which an IntFA state transitions back to itself, so
+ * that the lexer can skip over runs of them many bytes at a time.  The set is
+ * given as up to GZL_INTFA_MAX_SKIP_RANGES byte ranges, either listing the
+ * bytes that stay in the state or (if "exits" is set) the bytes that leave
+ * it, whichever takes fewer ranges.  num_ranges is 0 if the state has no
+ * skip. */
+#define GZL_INTFA_MAX_SKIP_RANGES 4
+struct gzl_intfa_skip
+{
+    bool exits;
+    int num_ranges;
+    uint8_t low[GZL_INTFA_MAX_SKIP_RANGES];
+    uint8_t high[GZL_INTFA_MAX_SKIP_RANGES];
 };
 
 struct gzl_intfa_transition
@@ -142,15 +216,37 @@ struct gzl_intfa_transition
 
 struct gzl_intfa_state
 {
-    char *final;  /* NULL if not final */
+    int final_id; /* 0 if not final */
     int num_transitions;
     struct gzl_intfa_transition *transitions;
+
+    /* A table built at load time, mapping each of the IntFA's byte classes to
+     * the offset of the destination state (or GZL_INTFA_NO_TRANSITION).  NULL
+     * if this IntFA did not fit in the table budget, in which case the
+     * transitions above are scanned instead. */
+    uint8_t *next_state;
+
+    /* Built along with next_state.  In "skip", newline bytes always leave
+     * the state so that line counting stays exact; "skip_no_lines" has no
+     * such restriction, and is used by parses that don't track lines. */
+    struct gzl_intfa_skip skip;
+    struct gzl_intfa_skip skip_no_lines;
+
+    char *final;  /* NULL if not final */
 };
 
+/* Every terminal has a small integer ID, assigned densely at load time.  The
+ * runtime identifies terminals only by ID; terminal_names maps IDs back to
+ * names.  ID 0 is always EOF, whose name is NULL. */
+#define GZL_TERMINAL_EOF 0
+
 struct gzl_grammar
 {
     char         **strings;
 
+    int num_terminals;
+    char **terminal_names;
+
     int num_rtns;
     struct gzl_rtn   *rtns;
 
@@ -159,12 +255,34 @@ struct gzl_grammar
 
     int num_intfas;
     struct gzl_intfa *intfas;
+
+    /* All of the above (but not the IntFA tables) is allocated from these,
+     * the state machines from "hot" and the names from "cold". */
+    struct gzl_arena hot;
+    struct gzl_arena cold;
+
+    /* Everything the grammar owns, the arenas' chunks included, comes from
+     * this allocator. */
+    struct gzl_allocator *allocator;
 };
 
-/* Functions for loading a grammar from a bytecode file. */
+/* Functions for loading a grammar from a bytecode file.  gzl_load_grammar()
+ * uses gzl_default_allocator. */
 struct gzl_grammar *gzl_load_grammar(struct bc_read_stream *s);
+struct gzl_grammar *gzl_load_grammar_with_allocator(
+    struct bc_read_stream *s, struct gzl_allocator *allocator);
 void gzl_free_grammar(struct gzl_grammar *g);
 
+/* Builds the byte class maps and per-state next_state tables that let the
+ * lexer take two table lookups per byte instead of scanning transition
+ * ranges.  IntFAs that are referenced by the most RTN and GLA states get
+ * tables first; once max_bytes of tables have been built, the remaining
+ * IntFAs fall back to range scanning.  gzl_load_grammar() calls this with
+ * GZL_DEFAULT_INTFA_TABLE_BUDGET; call it again to rebuild the tables with a
+ * different budget. */
+#define GZL_DEFAULT_INTFA_TABLE_BUDGET (256 * 1024)
+void gzl_build_intfa_tables(struct gzl_grammar *g, size_t max_bytes);
+
 #ifdef __cplusplus
 }  /* extern "C" */
 #endif
@@ -14,7 +14,9 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 
+#include "gazelle/allocator.h"
 #include "gazelle/bc_read_stream.h"
 #include "gazelle/dynarray.h"
 #include "gazelle/grammar.h"
@@ -39,11 +41,31 @@ struct gzl_offset
 
 struct gzl_terminal
 {
-    char *name;
+    int id;  /* name is grammar->terminal_names[id] */
     struct gzl_offset offset;
     size_t len;
 };
 
+/* The form in which the parser keeps terminals in its lookahead buffer, packed
+ * into 16 bytes.  Callbacks never see it: the parser builds a gzl_terminal
+ * from it when one is needed.  Line and column are kept apart from it (see
+ * token_positions in struct gzl_parse_state), and only when track_lines is
+ * set. */
+struct gzl_token
+{
+    uint64_t byte;  /* offset.byte of the terminal */
+    int32_t id;
+    uint32_t len;
+};
+
+/* The line and column of a buffered terminal, packed into 8 bytes.  Values
+ * that do not fit are stored as UINT32_MAX. */
+struct gzl_token_position
+{
+    uint32_t line;
+    uint32_t column;
+};
+
 struct gzl_parse_val;
 
 struct gzl_slotarray
@@ -69,38 +91,60 @@ struct gzl_parse_val
     } val;
 };
 
-/* This structure is the format for every stack frame of the parse stack. */
+enum gzl_frame_type {
+  GZL_FRAME_TYPE_RTN,
+  GZL_FRAME_TYPE_GLA
+};
+
+/* This structure is the format for every stack frame of the parse stack.  It
+ * is packed into 16 bytes so that even a deep stack takes only a few cache
+ * lines: the current state is the only pointer, everything else is a small
+ * index, and the frame's start offset lives in a parallel array
+ * (frame_offsets in struct gzl_parse_state).  Use the gzl_get_frame_*()
+ * functions below to inspect a frame. */
 struct gzl_parse_stack_frame
 {
     union {
-      struct gzl_rtn_frame {
-        struct gzl_rtn            *rtn;
-        struct gzl_rtn_state      *rtn_state;
-        struct gzl_rtn_transition *rtn_transition;
-      } rtn_frame;
-
-      struct gzl_gla_frame {
-        struct gzl_gla            *gla;
-        struct gzl_gla_state      *gla_state;
-      } gla_frame;
-
-      struct gzl_intfa_frame {
-        struct gzl_intfa          *intfa;
-        struct gzl_intfa_state    *intfa_state;
-      } intfa_frame;
-    } f;
-
-    struct gzl_offset start_offset;
-
-    enum gzl_frame_type {
-      GZL_FRAME_TYPE_RTN,
-      GZL_FRAME_TYPE_GLA,
-      GZL_FRAME_TYPE_INTFA
-    } frame_type;
+      struct gzl_rtn_state *rtn_state;
+      struct gzl_gla_state *gla_state;
+    } state;
+
+    /* For RTN frames, 1 + the offset of the last transition taken in
+     * rtn->transitions, or 0 if there is none.  For GLA frames, the offset of
+     * the GLA in grammar->glas. */
+    uint32_t index;
+
+    /* The frame type in the low bit, and for RTN frames the number of caller
+     * frames this frame replaced through tail calls (see eliminate_tail_calls
+     * below) in the rest. */
+    uint32_t type_and_elided;
 };
 
-#define GET_PARSE_STACK_FRAME(ptr) \
-    (struct gzl_parse_stack_frame*)((char*)ptr-offsetof(struct gzl_parse_stack_frame,f))
+/* The i'th frame of a parse state's stack, counting from the bottom. */
+#define GET_PARSE_STACK_FRAME(s, i) (&(s)->parse_stack[i])
+
+/* A record of one parse event, for clients that take their events in batches
+ * (see "events" in struct gzl_parse_state) instead of through the callbacks
+ * below.  For rules, id is the offset of the RTN in grammar->rtns; for
+ * terminals, it is the terminal ID.  slotnum is the slot that the rule or
+ * terminal fills in the rule that contains it, or -1 for the start rule.
+ *
+ * For end events, byte is where the rule ends (state->offset as an end_rule
+ * callback would see it), and slotnum and len are 0. */
+enum gzl_event_type {
+  GZL_EVENT_START_RULE,
+  GZL_EVENT_END_RULE,
+  GZL_EVENT_TERMINAL
+};
+
+struct gzl_event
+{
+    uint64_t byte;  /* where the rule or terminal begins (or the rule ends) */
+    int32_t id;
+    int32_t slotnum;
+    uint32_t len;   /* terminals only */
+    uint32_t type;  /* enum gzl_event_type */
+};
 
 /* A gzl_bound_grammar struct represents a grammar which has had callbacks bound
  * to it and has possibly been JIT-compiled.  Though JIT compilation is not
@@ -118,6 +162,9 @@ typedef void (*gzl_error_char_callback_t)(struct gzl_parse_state *state,
                                           int ch);
 typedef void (*gzl_error_terminal_callback_t)(struct gzl_parse_state *state,
                                               struct gzl_terminal *terminal);
+typedef void (*gzl_events_callback_t)(struct gzl_parse_state *state,
+                                      struct gzl_event *events,
+                                      int num_events);
 struct gzl_bound_grammar
 {
     struct gzl_grammar *grammar;
@@ -126,8 +173,77 @@ struct gzl_bound_grammar
     gzl_rule_callback_t end_rule_cb;
     gzl_error_char_callback_t error_char_cb;
     gzl_error_terminal_callback_t error_terminal_cb;
+
+    /* Receives the events that parse states with an event buffer batch up;
+     * see "events" in struct gzl_parse_state. */
+    gzl_events_callback_t events_cb;
+
+    /* If non-NULL, these select which rules (by offset in grammar->rtns) and
+     * which terminals (by ID) produce start_rule/end_rule and terminal events,
+     * whether they go to the callbacks or to an event buffer; the parser skips
+     * the others without calling anything.  NULL selects everything.  Build
+     * them with GZL_MASK_BYTES() and GZL_MASK_SET().
+     *
+     * With a rule mask, tail calls (see eliminate_tail_calls) never replace
+     * the frame of a selected rule, so every selected rule still gets its
+     * end event, and no end events are reported for the callers that are
+     * replaced. */
+    uint8_t *rule_mask;
+    uint8_t *terminal_mask;
+};
+
+/* Bit i of a rule or terminal mask is bit (i % 8) of byte (i / 8). */
+#define GZL_MASK_BYTES(n) (((n) + 7) / 8)
+#define GZL_MASK_SET(mask, i) ((mask)[(i) / 8] |= (uint8_t)(1 << ((i) % 8)))
+#define GZL_MASK_TEST(mask, i) (((mask)[(i) / 8] >> ((i) % 8)) & 1)
+
+/* A line index records where each line of the input begins, so that line and
+ * column numbers can be computed from a byte offset after the fact, instead of
+ * being counted byte by byte while parsing.  Lines are counted the same way
+ * the parser counts them when track_lines is set.
+ *
+ * The index grows by one entry per line of input seen. */
+struct gzl_line_start
+{
+    /* The offset of the first byte after the newline that began this line. */
+    size_t byte;
+
+    /* The offset of the first byte of the line that is not itself part of the
+     * newline sequence, ie. the byte in column 1. */
+    size_t column_1_byte;
 };
 
+struct gzl_line_index
+{
+    /* Lines after the first, in order. */
+    DEFINE_DYNARRAY(lines, struct gzl_line_start);
+
+    /* The number of bytes that have been added to the index so far. */
+    size_t bytes_scanned;
+
+    bool last_char_was_newline;
+
+    /* The allocator that the index and its lines come from. */
+    struct gzl_allocator *allocator;
+};
+
+/* gzl_alloc_line_index() uses gzl_default_allocator. */
+struct gzl_line_index *gzl_alloc_line_index();
+struct gzl_line_index *gzl_alloc_line_index_with_allocator(
+    struct gzl_allocator *allocator);
+void gzl_free_line_index(struct gzl_line_index *index);
+
+/* Adds the bytes in buf, which begins at byte offset buf_offset of the input,
+ * to the index.  Bytes that have been added before are ignored, so buffers
+ * may overlap what was previously added, but may not leave gaps. */
+void gzl_line_index_add(struct gzl_line_index *index, char *buf, size_t len,
+                        size_t buf_offset);
+
+/* Fills in offset->line and offset->column from offset->byte, which must be
+ * within the bytes that have been added to the index. */
+void gzl_line_index_lookup(struct gzl_line_index *index,
+                           struct gzl_offset *offset);
+
 /* This structure defines the core state of a parsing stream.  By saving this
  * state alone, we can resume a parse from the position where we left off.
  *
@@ -143,6 +259,10 @@ struct gzl_parse_state
     /* A pointer that the client can use for their own purposes. */
     void *user_data;
 
+    /* The allocator that the state's memory, and gzl_parse_file()'s buffer,
+     * come from. */
+    struct gzl_allocator *allocator;
+
     /* The offset of the next byte in the stream we will process. */
     struct gzl_offset offset;
 
@@ -161,6 +281,21 @@ struct gzl_parse_state
      * newline. */
     bool last_char_was_newline;
 
+    /* If false, only the byte offset is maintained while parsing, which saves
+     * some work for every byte of input.  The line and column of
+     * state->offset and of every offset passed to callbacks are then 0, but
+     * can be computed on demand with a line index (see below).  If true, the
+     * offsets of terminals report lines and columns past 2^32 - 1 as
+     * UINT32_MAX (see struct gzl_token_position); a line index has no such
+     * limit.  gzl_init_parse_state() sets this to true. */
+    bool track_lines;
+
+    /* If non-NULL, gzl_parse() adds every buffer it is given to this line
+     * index before parsing it, so that callbacks can look up line and column
+     * numbers with gzl_line_index_lookup() even when track_lines is false.
+     * gzl_init_parse_state() sets this to NULL; the client owns the index. */
+    struct gzl_line_index *line_index;
+
     /* Resource limits, which clients can use to prevent degenerate or malicious
      * input from taking up an arbitrary amount of resources.
      * gzl_init_parse_state() will set reasonable defaults for these, but the
@@ -175,16 +310,86 @@ struct gzl_parse_state
      * languages -- for LL(k), this is naturally bounded to k. */
     int max_lookahead;
 
+    /* If true, the parse stack and token buffer were allocated up front to
+     * the limits above, and are never resized: the parse allocates no memory
+     * (unless it has a line index), exceeding the limits returns
+     * GZL_STATUS_RESOURCE_LIMIT_EXCEEDED, and pointers to stack frames stay
+     * valid for as long as the frames are on the stack.  The limits must not
+     * be raised for such a state. */
+    bool preallocated;
+
+    /* If true, a nonterminal transition into a final state with no outgoing
+     * transitions is a tail call: the caller would only be popped as soon as
+     * the callee returns, so the callee's frame replaces it instead, and the
+     * stack stays shallow on right-recursive input.  Each callback still
+     * happens in the same order as without tail calls, but the end_rule
+     * callbacks for replaced frames come right after the one for the frame
+     * that replaced them, which is still on top of the stack while they run.
+     * It has no effect while events (below) is set, since the records could
+     * not name the replaced rules.  gzl_init_parse_state() sets this to
+     * false. */
+    bool eliminate_tail_calls;
+
+    /* Budgets that bound how much work one call to gzl_parse() does, so that
+     * a client can interleave many large parses.  gzl_parse() returns
+     * GZL_STATUS_PAUSED once it has consumed byte_budget bytes of its buffer
+     * or emitted token_budget terminals, whichever comes first; 0 means no
+     * budget.  A callback can also pause the parse by setting
+     * pause_requested, which takes effect once the terminal it was called
+     * for has been processed, and is cleared when it does.
+     * gzl_init_parse_state() sets all three to 0. */
+    size_t byte_budget;
+    int token_budget;
+    bool pause_requested;
+
+    /* If non-NULL, the start rule, end rule and terminal events are recorded
+     * here, up to max_events (which must be at least 1) at a time, instead
+     * of being passed to the bound grammar's callbacks for them.  The records
+     * are handed to events_cb whenever the buffer fills, before any error
+     * callback, and before gzl_parse() and gzl_finish_parse() return.
+     * num_events is the number of records waiting.  Set events before the
+     * parse begins, not partway through.  gzl_init_parse_state() sets events
+     * to NULL; the client owns the buffer. */
+    struct gzl_event *events;
+    int num_events;
+    int max_events;
+
     /* The parse stack is the main piece of state that the parser keeps.
-     * There is a stack frame for every RTN, GLA, and IntFA state we are
-     * currently in. */
+     * There is a stack frame for every RTN and GLA state we are currently
+     * in. */
     DEFINE_DYNARRAY(parse_stack, struct gzl_parse_stack_frame);
 
+    /* The offset where each frame of the parse stack began, which has room
+     * for parse_stack_size entries. */
+    struct gzl_offset *frame_offsets;
+
+    /* The IntFA that is lexing the next terminal, which belongs to the
+     * RTN or GLA state on top of the parse stack.  It is kept here instead of
+     * on the stack so that the lexer can run through the input without
+     * touching the stack until it emits a terminal.  NULL before the parse
+     * has begun and after it has hit hard EOF. */
+    struct gzl_intfa *intfa;
+    struct gzl_intfa_state *intfa_state;
+
+    /* The offset where the terminal being lexed began. */
+    struct gzl_offset intfa_start_offset;
+
     /* The token buffer stores tokens that have already been used to transition
      * the current GLA, but will be used to transition an RTN (and perhaps
      * other GLAs) when the current GLA hits a final state.  Keeping those
-     * terminals here prevents us from having to re-lex them. */
-    DEFINE_DYNARRAY(token_buffer, struct gzl_terminal);
+     * terminals here prevents us from having to re-lex them.
+     *
+     * It is a ring buffer, so that consumed tokens can be retired from the
+     * front in constant time: the i'th oldest token is at
+     * token_buffer[(token_buffer_head + i) & (token_buffer_size - 1)].
+     * token_buffer_size is always a power of two. */
+    DEFINE_DYNARRAY(token_buffer, struct gzl_token);
+    int token_buffer_head;
+
+    /* The line and column of each token in token_buffer, at the same index.
+     * Only written when track_lines is set, and NULL until then unless the
+     * state is preallocated. */
+    struct gzl_token_position *token_positions;
 };
 
 /* Begin or continue a parse using grammar g, with the current state of the
@@ -212,6 +417,10 @@ struct gzl_parse_state
  *    gzl_finish_parse() if it wants to receive final callbacks.
  *  - GZL_STATUS_RESOURCE_LIMIT_EXCEEDED: a resource limit like maximum stack
  *    depth or maximum lookahead limit was exceeded.
+ *  - GZL_STATUS_PAUSED: the parse stopped early because of a budget or a
+ *    pause request (see byte_budget above).  state->offset reflects how far
+ *    it got, and the parse resumes when gzl_parse() is called with the rest
+ *    of the buffer, beginning at state->offset.
  */
 enum gzl_status {
   GZL_STATUS_OK,
@@ -221,9 +430,13 @@ enum gzl_status {
   GZL_STATUS_RESOURCE_LIMIT_EXCEEDED,
 
   /* The following errors are Only returned by clients using the parse_file
-   * interface: */
+   * interface (or, for GZL_STATUS_PREMATURE_EOF_ERROR, parse_string): */
   GZL_STATUS_IO_ERROR,             /* Error reading the file, check errno. */
   GZL_STATUS_PREMATURE_EOF_ERROR,  /* File hit EOF but the grammar wasn't EOF */
+  GZL_STATUS_WOULD_BLOCK,          /* No data ready; see gzl_parse_fd() */
+
+  /* Only returned by gzl_parse(); see above. */
+  GZL_STATUS_PAUSED,
 };
 enum gzl_status gzl_parse(struct gzl_parse_state *state, char *buf, size_t buf_len);
 
@@ -233,23 +446,122 @@ enum gzl_status gzl_parse(struct gzl_parse_state *state, char *buf, size_t buf_l
 bool gzl_finish_parse(struct gzl_parse_state *s);
 
 struct gzl_parse_state *gzl_alloc_parse_state();
+struct gzl_parse_state *gzl_alloc_parse_state_with_allocator(
+    struct gzl_allocator *allocator);
 struct gzl_parse_state *gzl_dup_parse_state(struct gzl_parse_state *state);
 void gzl_free_parse_state(struct gzl_parse_state *state);
 void gzl_init_parse_state(struct gzl_parse_state *state, struct gzl_bound_grammar *bg);
 
+/* Rewinds a parse state to the beginning of the input, so that it can parse
+ * another document with the same bound grammar.  Unlike
+ * gzl_init_parse_state(), this leaves the client's settings (user_data,
+ * track_lines, line_index, the resource limits, eliminate_tail_calls and the
+ * budgets) alone.  The stack and token buffer keep the memory they have grown
+ * to, so documents no larger than earlier ones are parsed without allocating.
+ * A line index must be emptied or replaced by the client. */
+void gzl_reset_parse_state(struct gzl_parse_state *state);
+
+/* Parses a whole document that is entirely in buf, from the beginning:
+ * resets the state, parses buf and finishes the parse.  Returns
+ * GZL_STATUS_OK if the document was complete, GZL_STATUS_PREMATURE_EOF_ERROR
+ * if the grammar did not allow it to end where it did, and otherwise what
+ * gzl_parse() returned.  If the grammar reached EOF before the end of buf, the
+ * rest of buf is not parsed; state->offset tells how much was.  Pauses (see
+ * byte_budget) are resumed from right away, so this never returns
+ * GZL_STATUS_PAUSED.
+ *
+ * This does not touch the heap if the state's stack and token buffer are
+ * large enough for the document, as they are for a preallocated state or one
+ * that has already parsed a similar document. */
+enum gzl_status gzl_parse_string(struct gzl_parse_state *state,
+                                 char *buf, size_t buf_len);
+
+/* A pool of parse states that have been used before, whose stacks and token
+ * buffers have kept the capacity they grew to.  Taking a state from the pool
+ * only costs a gzl_init_parse_state(), so clients that parse many small
+ * documents can avoid allocating for each one.  A pool is not thread-safe;
+ * threads should each keep their own. */
+struct gzl_parse_state_pool
+{
+    DEFINE_DYNARRAY(states, struct gzl_parse_state*);
+
+    /* The allocator that the pool, and the states it allocates, come from. */
+    struct gzl_allocator *allocator;
+};
+
+/* gzl_alloc_parse_state_pool() uses gzl_default_allocator. */
+struct gzl_parse_state_pool *gzl_alloc_parse_state_pool();
+struct gzl_parse_state_pool *gzl_alloc_parse_state_pool_with_allocator(
+    struct gzl_allocator *allocator);
+
+/* Frees the pool and every state in it, but not states that have been taken
+ * from it and not returned. */
+void gzl_free_parse_state_pool(struct gzl_parse_state_pool *pool);
+
+/* Returns a state that has been initialized with gzl_init_parse_state(),
+ * allocating one if the pool is empty.  Return it to the pool with
+ * gzl_return_parse_state() instead of freeing it. */
+struct gzl_parse_state *gzl_take_parse_state(struct gzl_parse_state_pool *pool,
+                                             struct gzl_bound_grammar *bg);
+void gzl_return_parse_state(struct gzl_parse_state_pool *pool,
+                            struct gzl_parse_state *state);
+
+/* Functions for parse states whose stack and token buffer are preallocated
+ * (see "preallocated" above), in the same block of memory as the state
+ * itself.  gzl_init_parse_state() keeps the limits these were created with.
+ *
+ * gzl_alloc_fixed_parse_state() allocates the block, which is freed with
+ * gzl_free_parse_state() as usual.  gzl_place_fixed_parse_state() instead
+ * builds the state in a block the client provides, which must be at least
+ * gzl_fixed_parse_state_size() bytes and aligned as for malloc(); the client
+ * frees the block itself, and must not call gzl_free_parse_state(). */
+size_t gzl_fixed_parse_state_size(int max_stack_depth, int max_lookahead);
+struct gzl_parse_state *gzl_alloc_fixed_parse_state(int max_stack_depth,
+                                                    int max_lookahead);
+struct gzl_parse_state *gzl_place_fixed_parse_state(void *mem,
+                                                    int max_stack_depth,
+                                                    int max_lookahead);
+
+/* Functions for inspecting a frame of a parse state's stack, typically from
+ * inside a callback.  The start offset is where the input for the frame's rule
+ * (or GLA) began. */
+enum gzl_frame_type gzl_get_frame_type(struct gzl_parse_state *s,
+                                       struct gzl_parse_stack_frame *frame);
+struct gzl_offset *gzl_get_frame_start_offset(
+    struct gzl_parse_state *s, struct gzl_parse_stack_frame *frame);
+
+/* For RTN frames only.  The transition is the one the frame took last (for a
+ * nonterminal transition, the one for the frame above it), or NULL if the
+ * frame has not taken one yet. */
+struct gzl_rtn *gzl_get_frame_rtn(struct gzl_parse_state *s,
+                                  struct gzl_parse_stack_frame *frame);
+struct gzl_rtn_state *gzl_get_frame_rtn_state(
+    struct gzl_parse_state *s, struct gzl_parse_stack_frame *frame);
+struct gzl_rtn_transition *gzl_get_frame_rtn_transition(
+    struct gzl_parse_state *s, struct gzl_parse_stack_frame *frame);
+int gzl_get_frame_elided_frames(struct gzl_parse_state *s,
+                                struct gzl_parse_stack_frame *frame);
+
+/* For GLA frames only. */
+struct gzl_gla *gzl_get_frame_gla(struct gzl_parse_state *s,
+                                  struct gzl_parse_stack_frame *frame);
+struct gzl_gla_state *gzl_get_frame_gla_state(
+    struct gzl_parse_state *s, struct gzl_parse_stack_frame *frame);
+
 /* A buffering layer provides the most common use case of parsing a whole file
  * by streaming from a FILE*.  This "struct buffer" will be the parse state's
- * user_data, the client's user_data is inside "struct buffer". */
+ * user_data, the client's user_data is inside "struct buffer".  Like
+ * gzl_parse_string(), it resumes from pauses right away. */
 struct gzl_buffer
 {
     /* The buffer itself. */
     DEFINE_DYNARRAY(buf, char);
 
     /* The file offset of the first byte currently in the buffer. */
-    int buf_offset;
+    size_t buf_offset;
 
     /* The number of bytes that have been successfully parsed. */
-    int bytes_parsed;
+    size_t bytes_parsed;
 
     /* The user_data you passed to parse_file. */
     void *user_data;
@@ -259,6 +571,50 @@ enum gzl_status gzl_parse_file(struct gzl_parse_state *state,
                                FILE *file, void *user_data,
                                int max_buffer_size);
 
+/* Like gzl_parse_file(), but reads into buf, which the client provides,
+ * instead of a buffer of its own.  buf is never resized: if the input that
+ * must be kept for open terminals fills it, this returns
+ * GZL_STATUS_RESOURCE_LIMIT_EXCEEDED.  With a preallocated parse state and no
+ * line index, the parse allocates no memory at all (though the C library may
+ * for the FILE). */
+enum gzl_status gzl_parse_file_fixed(struct gzl_parse_state *state,
+                                     FILE *file, void *user_data,
+                                     char *buf, int buf_size);
+
+/* Like gzl_parse_file(), but reads straight from a file descriptor with
+ * read(2), which saves the copy through a FILE's buffer, and suits pipes and
+ * sockets.  If fd is non-blocking and has no data ready, this returns
+ * GZL_STATUS_WOULD_BLOCK once it has parsed everything it read; call it again
+ * with the same state and buffer when fd is readable, and it picks up where
+ * it left off.  The buffer carries the data of the open terminals from one
+ * call to the next: set it up with gzl_init_buffer() before the first call,
+ * and release it with gzl_free_buffer() once the parse is done. */
+void gzl_init_buffer(struct gzl_buffer *buffer, void *user_data);
+void gzl_free_buffer(struct gzl_parse_state *state, struct gzl_buffer *buffer);
+enum gzl_status gzl_parse_fd(struct gzl_parse_state *state, int fd,
+                             struct gzl_buffer *buffer, int max_buffer_size);
+
+/* Like gzl_parse_file(), but a second thread reads the file ahead of the
+ * parse, so that waiting for the disk overlaps with parsing.  Reads are of up
+ * to half of max_buffer_size (at most 4MB), and the open terminals can take up
+ * the rest.  Callbacks must not touch the FILE while the parse is running.
+ * Returns only once the reader thread has finished, which for a pipe or
+ * terminal may mean waiting for one more read. */
+enum gzl_status gzl_parse_file_read_ahead(struct gzl_parse_state *state,
+                                          FILE *file, void *user_data,
+                                          int max_buffer_size);
+
+/* Like gzl_parse_file(), but maps the file at path into memory instead of
+ * reading it, so that buf in the callbacks' struct gzl_buffer points straight
+ * into the mapping and nothing is copied.  The input is read sequentially, and
+ * on large files the pages before the open terminals are released as the
+ * parse goes, so memory use stays flat.  Returns GZL_STATUS_IO_ERROR (check
+ * errno) if the file cannot be opened or mapped, and with errno set to ENODEV
+ * if it is not a regular file; use gzl_parse_fd() for pipes and other special
+ * files. */
+enum gzl_status gzl_parse_mmap(struct gzl_parse_state *state,
+                               const char *path, void *user_data);
+
 #ifdef __cplusplus
 }  /* extern "C" */
 #endif
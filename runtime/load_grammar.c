@@ -11,6 +11,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "gazelle/bc_read_stream.h"
 #include "gazelle/grammar.h"
@@ -88,7 +89,7 @@ void unexpected(struct bc_read_stream *s, struct record_info ri)
 }
 
 static
-char **load_strings(struct bc_read_stream *s)
+char **load_strings(struct bc_read_stream *s, struct gzl_grammar *g)
 {
     /* first get a count of the strings */
     int num_strings = 0;
@@ -105,7 +106,7 @@ char **load_strings(struct bc_read_stream *s)
     }
 
     bc_rs_rewind_block(s);
-    char **strings = malloc((num_strings+1) * sizeof(*strings));
+    char **strings = gzl_arena_alloc(&g->cold, (num_strings+1) * sizeof(*strings));
     int string_offset = 0;
 
     while(1)
@@ -113,7 +114,7 @@ char **load_strings(struct bc_read_stream *s)
         struct record_info ri = bc_rs_next_data_record(s);
         if(ri.record_type == DataRecord && ri.id == BC_STRING)
         {
-            char *str = malloc((bc_rs_get_record_size(s)+1) * sizeof(char));
+            char *str = gzl_arena_alloc(&g->cold, (bc_rs_get_record_size(s)+1) * sizeof(char));
             int i;
             for(i = 0; bc_rs_get_remaining_record_size(s) > 0; i++)
             {
@@ -137,7 +138,7 @@ char **load_strings(struct bc_read_stream *s)
 }
 
 static
-void load_intfa(struct bc_read_stream *s, struct gzl_intfa *intfa, char **strings)
+void load_intfa(struct bc_read_stream *s, struct gzl_intfa *intfa, struct gzl_grammar *g)
 {
     /* first get a count of the states and transitions */
     intfa->num_states = 0;
@@ -160,8 +161,11 @@ void load_intfa(struct bc_read_stream *s, struct gzl_intfa *intfa, char **string
     }
 
     bc_rs_rewind_block(s);
-    intfa->states = malloc(intfa->num_states * sizeof(*intfa->states));
-    intfa->transitions = malloc(intfa->num_transitions * sizeof(*intfa->transitions));
+    intfa->states = gzl_arena_alloc(&g->hot, intfa->num_states * sizeof(*intfa->states));
+    intfa->transitions = gzl_arena_alloc(&g->hot, intfa->num_transitions * sizeof(*intfa->transitions));
+    intfa->tables = NULL;
+    intfa->byte_class = NULL;
+    intfa->num_classes = 0;
     int state_offset = 0;
     int transition_offset = 0;
     int state_transition_offset = 0;
@@ -178,11 +182,23 @@ void load_intfa(struct bc_read_stream *s, struct gzl_intfa *intfa, char **string
                 state->num_transitions = bc_rs_read_next_32(s);
                 state->transitions = &intfa->transitions[state_transition_offset];
                 state_transition_offset += state->num_transitions;
+                state->next_state = NULL;
+                state->skip.num_ranges = 0;
+                state->skip_no_lines.num_ranges = 0;
 
                 if(ri.id == BC_INTFA_FINAL_STATE)
-                    state->final = strings[bc_rs_read_next_32(s)];
+                {
+                    /* Terminal IDs are string offsets + 1 until
+                     * assign_terminal_ids() renumbers them. */
+                    int str = bc_rs_read_next_32(s);
+                    state->final = g->strings[str];
+                    state->final_id = str + 1;
+                }
                 else
+                {
                     state->final = NULL;
+                    state->final_id = 0;
+                }
             }
             else if(ri.id == BC_INTFA_TRANSITION || ri.id == BC_INTFA_TRANSITION_RANGE)
             {
@@ -228,7 +244,7 @@ void load_intfas(struct bc_read_stream *s, struct gzl_grammar *g)
     }
 
     bc_rs_rewind_block(s);
-    g->intfas = malloc((g->num_intfas) * sizeof(*g->intfas));
+    g->intfas = gzl_arena_alloc(&g->hot, (g->num_intfas) * sizeof(*g->intfas));
     int intfa_offset = 0;
 
     while(1)
@@ -236,7 +252,7 @@ void load_intfas(struct bc_read_stream *s, struct gzl_grammar *g)
         struct record_info ri = bc_rs_next_data_record(s);
         if(ri.record_type == StartBlock && ri.id == BC_INTFA)
         {
-            load_intfa(s, &g->intfas[intfa_offset++], g->strings);
+            load_intfa(s, &g->intfas[intfa_offset++], g);
         }
         else if(ri.record_type == EndBlock)
             break;
@@ -270,8 +286,8 @@ void load_gla(struct bc_read_stream *s, struct gzl_gla *gla, struct gzl_grammar
     }
 
     bc_rs_rewind_block(s);
-    gla->states = malloc(gla->num_states * sizeof(*gla->states));
-    gla->transitions = malloc(gla->num_transitions * sizeof(*gla->transitions));
+    gla->states = gzl_arena_alloc(&g->hot, gla->num_states * sizeof(*gla->states));
+    gla->transitions = gzl_arena_alloc(&g->hot, gla->num_transitions * sizeof(*gla->transitions));
 
     int state_offset = 0;
     int transition_offset = 0;
@@ -306,6 +322,7 @@ void load_gla(struct bc_read_stream *s, struct gzl_gla *gla, struct gzl_grammar
                 int term = bc_rs_read_next_32(s);
                 int dest_state_offset = bc_rs_read_next_32(s);
                 transition->dest_state = &gla->states[dest_state_offset];
+                transition->term_id = term;
                 if(term == 0)
                     transition->term = NULL;
                 else
@@ -339,7 +356,7 @@ void load_glas(struct bc_read_stream *s, struct gzl_grammar *g)
     }
 
     bc_rs_rewind_block(s);
-    g->glas = malloc(g->num_glas * sizeof(*g->glas));
+    g->glas = gzl_arena_alloc(&g->hot, g->num_glas * sizeof(*g->glas));
     int gla_offset = 0;
 
     while(1)
@@ -383,8 +400,8 @@ void load_rtn(struct bc_read_stream *s, struct gzl_rtn *rtn, struct gzl_grammar
     }
 
     bc_rs_rewind_block(s);
-    rtn->states = malloc(rtn->num_states * sizeof(*rtn->states));
-    rtn->transitions = malloc(rtn->num_transitions * sizeof(*rtn->transitions));
+    rtn->states = gzl_arena_alloc(&g->hot, rtn->num_states * sizeof(*rtn->states));
+    rtn->transitions = gzl_arena_alloc(&g->hot, rtn->num_transitions * sizeof(*rtn->transitions));
 
     int state_offset = 0;
     int transition_offset = 0;
@@ -406,6 +423,7 @@ void load_rtn(struct bc_read_stream *s, struct gzl_rtn *rtn, struct gzl_grammar
             {
                 struct gzl_rtn_state *state = &rtn->states[state_offset++];
 
+                state->rtn = rtn;
                 state->num_transitions = bc_rs_read_next_32(s);
                 state->transitions = &rtn->transitions[state_transition_offset];
                 state_transition_offset += state->num_transitions;
@@ -437,8 +455,10 @@ void load_rtn(struct bc_read_stream *s, struct gzl_rtn *rtn, struct gzl_grammar
 
                 if(ri.id == BC_RTN_TRANSITION_TERMINAL)
                 {
+                    int str = bc_rs_read_next_32(s);
                     transition->transition_type = GZL_TERMINAL_TRANSITION;
-                    transition->edge.terminal_name = g->strings[bc_rs_read_next_32(s)];
+                    transition->edge.terminal_name = g->strings[str];
+                    transition->terminal_id = str + 1;
                 }
                 else if(ri.id == BC_RTN_TRANSITION_NONTERM)
                 {
@@ -478,7 +498,7 @@ void load_rtns(struct bc_read_stream *s, struct gzl_grammar *g)
     }
 
     bc_rs_rewind_block(s);
-    g->rtns = malloc(g->num_rtns * sizeof(*g->rtns));
+    g->rtns = gzl_arena_alloc(&g->hot, g->num_rtns * sizeof(*g->rtns));
     int rtn_offset = 0;
 
     while(1)
@@ -495,13 +515,595 @@ void load_rtns(struct bc_read_stream *s, struct gzl_grammar *g)
     }
 }
 
+/* Memory that isn't allocated from the grammar's arenas: the IntFA tables,
+ * which can be rebuilt, and scratch space for building tables. */
+static
+void *grammar_alloc(struct gzl_grammar *g, size_t size)
+{
+    return g->allocator->alloc(g->allocator, size);
+}
+
+static
+void grammar_free(struct gzl_grammar *g, void *ptr, size_t size)
+{
+    g->allocator->free(g->allocator, ptr, size);
+}
+
+/*
+ * Building the IntFA next-state tables.  Each table is a direct map from an
+ * input byte to a destination state, so that the lexer doesn't have to scan
+ * a state's list of transition ranges for every byte of input.
+ */
+
+struct intfa_usage
+{
+    int intfa_offset;
+    int num_refs;
+};
+
+static
+int compare_intfa_usage(const void *a, const void *b)
+{
+    const struct intfa_usage *usage_a = a;
+    const struct intfa_usage *usage_b = b;
+
+    /* Most-used first; break ties by offset to keep the order stable. */
+    if(usage_a->num_refs != usage_b->num_refs)
+        return usage_b->num_refs - usage_a->num_refs;
+    return usage_a->intfa_offset - usage_b->intfa_offset;
+}
+
+static
+size_t get_intfa_tables_size(struct gzl_intfa *intfa, int num_classes)
+{
+    return 256 + (intfa->num_states * num_classes);
+}
+
+static
+void free_intfa_tables(struct gzl_grammar *g, struct gzl_intfa *intfa)
+{
+    for(int i = 0; i < intfa->num_states; i++)
+    {
+        intfa->states[i].next_state = NULL;
+        intfa->states[i].skip.num_ranges = 0;
+        intfa->states[i].skip_no_lines.num_ranges = 0;
+    }
+    if(intfa->tables)
+        grammar_free(g, intfa->tables,
+                     get_intfa_tables_size(intfa, intfa->num_classes));
+    intfa->tables = NULL;
+    intfa->byte_class = NULL;
+    intfa->num_classes = 0;
+}
+
+/* Fills dests with each state's destination for every byte: dests[ch] is a
+ * column of num_states destinations for byte ch. */
+static
+void get_intfa_dests(struct gzl_intfa *intfa, uint8_t *dests)
+{
+    memset(dests, GZL_INTFA_NO_TRANSITION, intfa->num_states * 256);
+    for(int i = 0; i < intfa->num_states; i++)
+    {
+        struct gzl_intfa_state *state = &intfa->states[i];
+
+        /* Fill in reverse so that if ranges overlap, the first matching
+         * transition wins, just as it does when scanning the ranges. */
+        for(int j = state->num_transitions - 1; j >= 0; j--)
+        {
+            struct gzl_intfa_transition *t = &state->transitions[j];
+            for(int ch = t->ch_low; ch <= t->ch_high; ch++)
+                dests[(ch * intfa->num_states) + i] = t->dest_state - intfa->states;
+        }
+    }
+}
+
+/* Two bytes are in the same class if every state sends them to the same
+ * place.  Returns the number of classes; class_rep[c] is a byte in class c. */
+static
+int get_byte_classes(struct gzl_intfa *intfa, uint8_t *dests,
+                     uint8_t *byte_class, int *class_rep)
+{
+    int num_classes = 0;
+    for(int ch = 0; ch < 256; ch++)
+    {
+        uint8_t *column = &dests[ch * intfa->num_states];
+        int c;
+        for(c = 0; c < num_classes; c++)
+            if(memcmp(column, &dests[class_rep[c] * intfa->num_states],
+                      intfa->num_states) == 0)
+                break;
+
+        if(c == num_classes)
+            class_rep[num_classes++] = ch;
+        byte_class[ch] = c;
+    }
+    return num_classes;
+}
+
+/* Appends the ranges of bytes for which in_set[ch] == want to skip, returning
+ * false if there are more than GZL_INTFA_MAX_SKIP_RANGES of them. */
+static
+bool get_skip_ranges(bool *in_set, bool want, struct gzl_intfa_skip *skip)
+{
+    skip->num_ranges = 0;
+    for(int ch = 0; ch < 256; ch++)
+    {
+        if(in_set[ch] != want)
+            continue;
+
+        if(skip->num_ranges > 0 && skip->high[skip->num_ranges-1] == ch - 1)
+        {
+            skip->high[skip->num_ranges-1] = ch;
+        }
+        else
+        {
+            if(skip->num_ranges == GZL_INTFA_MAX_SKIP_RANGES)
+                return false;
+            skip->low[skip->num_ranges] = skip->high[skip->num_ranges] = ch;
+            skip->num_ranges++;
+        }
+    }
+    return true;
+}
+
+static
+void build_intfa_skip(struct gzl_intfa *intfa, uint8_t *dests, int state_offset,
+                      bool newlines_leave, struct gzl_intfa_skip *skip)
+{
+    bool stays[256];
+    bool any_stay = false;
+
+    for(int ch = 0; ch < 256; ch++)
+    {
+        bool is_newline = (ch == 0x0A || ch == 0x0D);  /* LF and CR */
+        stays[ch] = dests[(ch * intfa->num_states) + state_offset] == state_offset &&
+                    !(newlines_leave && is_newline);
+        any_stay = any_stay || stays[ch];
+    }
+
+    skip->num_ranges = 0;
+    if(!any_stay)
+        return;
+
+    /* Describe the set whichever way takes fewer ranges. */
+    skip->exits = false;
+    if(get_skip_ranges(stays, true, skip))
+        return;
+    skip->exits = true;
+    if(get_skip_ranges(stays, false, skip))
+        return;
+    skip->num_ranges = 0;
+}
+
+static
+void build_intfa_tables(struct gzl_grammar *g, struct gzl_intfa *intfa,
+                        uint8_t *dests, uint8_t *byte_class, int *class_rep,
+                        int num_classes)
+{
+    intfa->tables =
+        grammar_alloc(g, get_intfa_tables_size(intfa, num_classes));
+    intfa->num_classes = num_classes;
+    intfa->byte_class = intfa->tables;
+    memcpy(intfa->byte_class, byte_class, 256);
+
+    for(int i = 0; i < intfa->num_states; i++)
+    {
+        struct gzl_intfa_state *state = &intfa->states[i];
+        state->next_state = intfa->tables + 256 + (i * num_classes);
+        for(int c = 0; c < num_classes; c++)
+            state->next_state[c] = dests[(class_rep[c] * intfa->num_states) + i];
+        build_intfa_skip(intfa, dests, i, true, &state->skip);
+        build_intfa_skip(intfa, dests, i, false, &state->skip_no_lines);
+    }
+}
+
 /*
  * The rest of this file is the publicly-exposed API
  */
 
+void gzl_build_intfa_tables(struct gzl_grammar *g, size_t max_bytes)
+{
+    /* We can't know ahead of time which IntFAs the input will exercise most,
+     * so we use the number of RTN and GLA states that lex with each IntFA as
+     * an estimate. */
+    struct intfa_usage *usage =
+        grammar_alloc(g, g->num_intfas * sizeof(*usage));
+    for(int i = 0; i < g->num_intfas; i++)
+    {
+        usage[i].intfa_offset = i;
+        usage[i].num_refs = 0;
+    }
+
+    for(int i = 0; i < g->num_rtns; i++)
+    {
+        struct gzl_rtn *rtn = &g->rtns[i];
+        for(int j = 0; j < rtn->num_states; j++)
+            if(rtn->states[j].lookahead_type == GZL_STATE_HAS_INTFA)
+                usage[rtn->states[j].d.state_intfa - g->intfas].num_refs++;
+    }
+
+    for(int i = 0; i < g->num_glas; i++)
+    {
+        struct gzl_gla *gla = &g->glas[i];
+        for(int j = 0; j < gla->num_states; j++)
+            if(!gla->states[j].is_final)
+                usage[gla->states[j].d.nonfinal.intfa - g->intfas].num_refs++;
+    }
+
+    qsort(usage, g->num_intfas, sizeof(*usage), compare_intfa_usage);
+
+    size_t bytes_used = 0;
+    uint8_t byte_class[256];
+    int class_rep[256];
+    for(int i = 0; i < g->num_intfas; i++)
+    {
+        struct gzl_intfa *intfa = &g->intfas[usage[i].intfa_offset];
+        free_intfa_tables(g, intfa);
+
+        /* State offsets must fit in a byte without colliding with
+         * GZL_INTFA_NO_TRANSITION. */
+        if(intfa->num_states > GZL_INTFA_NO_TRANSITION)
+            continue;
+
+        uint8_t *dests = grammar_alloc(g, intfa->num_states * 256);
+        get_intfa_dests(intfa, dests);
+        int num_classes = get_byte_classes(intfa, dests, byte_class, class_rep);
+        size_t tables_size = get_intfa_tables_size(intfa, num_classes);
+        if(bytes_used + tables_size <= max_bytes)
+        {
+            build_intfa_tables(g, intfa, dests, byte_class, class_rep,
+                               num_classes);
+            bytes_used += tables_size;
+        }
+        grammar_free(g, dests, intfa->num_states * 256);
+    }
+
+    grammar_free(g, usage, g->num_intfas * sizeof(*usage));
+}
+
+static
+void renumber_terminal(struct gzl_grammar *g, int *ids, int *id)
+{
+    if(*id != GZL_TERMINAL_EOF && ids[*id] == 0)
+    {
+        g->terminal_names[g->num_terminals] = g->strings[*id - 1];
+        ids[*id] = g->num_terminals++;
+    }
+    *id = ids[*id];
+}
+
+/* While loading, every terminal's ID is the offset of its name in
+ * g->strings plus one (which leaves 0 for EOF).  Now that the whole grammar is
+ * loaded, renumber them densely and build the table of names. */
+static
+void assign_terminal_ids(struct gzl_grammar *g)
+{
+    int num_strings = 0;
+    while(g->strings[num_strings] != NULL)
+        num_strings++;
+
+    int *ids = grammar_alloc(g, (num_strings + 1) * sizeof(*ids));
+    memset(ids, 0, (num_strings + 1) * sizeof(*ids));
+    g->terminal_names = gzl_arena_alloc(&g->cold,
+        (num_strings + 1) * sizeof(*g->terminal_names));
+    g->terminal_names[GZL_TERMINAL_EOF] = NULL;
+    g->num_terminals = 1;
+
+    for(int i = 0; i < g->num_intfas; i++)
+    {
+        struct gzl_intfa *intfa = &g->intfas[i];
+        for(int j = 0; j < intfa->num_states; j++)
+            if(intfa->states[j].final)
+                renumber_terminal(g, ids, &intfa->states[j].final_id);
+    }
+
+    for(int i = 0; i < g->num_glas; i++)
+    {
+        struct gzl_gla *gla = &g->glas[i];
+        for(int j = 0; j < gla->num_transitions; j++)
+            renumber_terminal(g, ids, &gla->transitions[j].term_id);
+    }
+
+    for(int i = 0; i < g->num_rtns; i++)
+    {
+        struct gzl_rtn *rtn = &g->rtns[i];
+        for(int j = 0; j < rtn->num_transitions; j++)
+            if(rtn->transitions[j].transition_type == GZL_TERMINAL_TRANSITION)
+                renumber_terminal(g, ids,
+                                  &rtn->transitions[j].terminal_id);
+    }
+
+    grammar_free(g, ids, (num_strings + 1) * sizeof(*ids));
+}
+
+/*
+ * Terminal dispatch tables.
+ */
+
+struct dispatch_entry
+{
+    int terminal_id;
+    int offset;
+};
+
+static
+int compare_dispatch_entry(const void *a, const void *b)
+{
+    const struct dispatch_entry *entry_a = a, *entry_b = b;
+    if(entry_a->terminal_id != entry_b->terminal_id)
+        return entry_a->terminal_id - entry_b->terminal_id;
+    return entry_a->offset - entry_b->offset;
+}
+
+/* Sorts the entries by terminal ID, keeping only the first transition for
+ * each terminal (which is the one a linear search would find).  Returns the
+ * number of entries left. */
+static
+int sort_dispatch_entries(struct dispatch_entry *entries, int num_entries)
+{
+    qsort(entries, num_entries, sizeof(*entries), compare_dispatch_entry);
+    int len = 0;
+    for(int i = 0; i < num_entries; i++)
+        if(len == 0 || entries[len-1].terminal_id != entries[i].terminal_id)
+            entries[len++] = entries[i];
+    return len;
+}
+
+static
+int get_dispatch_size(int num_entries, int num_terminals)
+{
+    if(num_entries >= GZL_DENSE_DISPATCH_MIN_TERMINALS)
+        return num_terminals;
+    else
+        return num_entries * 2;
+}
+
+/* Builds a dispatch table for the given sorted entries in storage, returning
+ * the storage that follows it. */
+static
+int *build_dispatch(struct gzl_terminal_dispatch *dispatch,
+                    struct dispatch_entry *entries, int num_entries,
+                    int num_terminals, int *storage)
+{
+    if(num_entries >= GZL_DENSE_DISPATCH_MIN_TERMINALS)
+    {
+        dispatch->dense = true;
+        dispatch->len = num_terminals;
+        dispatch->terminal_ids = NULL;
+        dispatch->offsets = storage;
+        for(int i = 0; i < num_terminals; i++)
+            dispatch->offsets[i] = -1;
+        for(int i = 0; i < num_entries; i++)
+            dispatch->offsets[entries[i].terminal_id] = entries[i].offset;
+        return storage + num_terminals;
+    }
+    else
+    {
+        dispatch->dense = false;
+        dispatch->len = num_entries;
+        dispatch->terminal_ids = storage;
+        dispatch->offsets = storage + num_entries;
+        for(int i = 0; i < num_entries; i++)
+        {
+            dispatch->terminal_ids[i] = entries[i].terminal_id;
+            dispatch->offsets[i] = entries[i].offset;
+        }
+        return storage + num_entries * 2;
+    }
+}
+
+static
+int get_rtn_state_entries(struct gzl_rtn_state *state,
+                          struct dispatch_entry *entries)
+{
+    int num_entries = 0;
+    for(int i = 0; i < state->num_transitions; i++)
+    {
+        struct gzl_rtn_transition *t = &state->transitions[i];
+        if(t->transition_type == GZL_TERMINAL_TRANSITION)
+        {
+            entries[num_entries].terminal_id = t->terminal_id;
+            entries[num_entries++].offset = i;
+        }
+    }
+    return sort_dispatch_entries(entries, num_entries);
+}
+
+static
+int get_gla_state_entries(struct gzl_gla_state *state,
+                          struct dispatch_entry *entries)
+{
+    int num_entries = state->d.nonfinal.num_transitions;
+    for(int i = 0; i < num_entries; i++)
+    {
+        entries[i].terminal_id = state->d.nonfinal.transitions[i].term_id;
+        entries[i].offset = i;
+    }
+    return sort_dispatch_entries(entries, num_entries);
+}
+
+static
+void build_ll1_dispatch(struct gzl_grammar *g, struct gzl_gla *gla)
+{
+    struct gzl_nonfinal_info *start = &gla->states[0].d.nonfinal;
+    gla->is_ll1 = true;
+    for(int i = 0; i < start->num_transitions; i++)
+        if(!start->transitions[i].dest_state->is_final)
+            gla->is_ll1 = false;
+    if(!gla->is_ll1)
+        return;
+
+    struct dispatch_entry *entries =
+        grammar_alloc(g, start->num_transitions * sizeof(*entries));
+    int num_entries = get_gla_state_entries(&gla->states[0], entries);
+    for(int i = 0; i < num_entries; i++)
+    {
+        struct gzl_gla_state *dest =
+            start->transitions[entries[i].offset].dest_state;
+        entries[i].offset = dest->d.final.transition_offset;
+    }
+
+    int size = get_dispatch_size(num_entries, g->num_terminals);
+    int *storage = gzl_arena_alloc(&g->hot, size * sizeof(*storage));
+    build_dispatch(&gla->ll1_dispatch, entries, num_entries, g->num_terminals,
+                   storage);
+    grammar_free(g, entries, start->num_transitions * sizeof(*entries));
+}
+
+static
+void build_dispatch_tables(struct gzl_grammar *g)
+{
+    for(int i = 0; i < g->num_rtns; i++)
+    {
+        struct gzl_rtn *rtn = &g->rtns[i];
+        struct dispatch_entry *entries =
+            grammar_alloc(g, rtn->num_transitions * sizeof(*entries));
+
+        int size = 0;
+        for(int j = 0; j < rtn->num_states; j++)
+        {
+            int num_entries = get_rtn_state_entries(&rtn->states[j], entries);
+            size += get_dispatch_size(num_entries, g->num_terminals);
+        }
+
+        int *storage = gzl_arena_alloc(&g->hot, size * sizeof(*storage));
+        for(int j = 0; j < rtn->num_states; j++)
+        {
+            struct gzl_rtn_state *state = &rtn->states[j];
+            int num_entries = get_rtn_state_entries(state, entries);
+            storage = build_dispatch(&state->dispatch, entries, num_entries,
+                                     g->num_terminals, storage);
+        }
+        grammar_free(g, entries, rtn->num_transitions * sizeof(*entries));
+    }
+
+    for(int i = 0; i < g->num_glas; i++)
+    {
+        struct gzl_gla *gla = &g->glas[i];
+        struct dispatch_entry *entries =
+            grammar_alloc(g, gla->num_transitions * sizeof(*entries));
+
+        int size = 0;
+        for(int j = 0; j < gla->num_states; j++)
+        {
+            if(gla->states[j].is_final)
+                continue;
+            int num_entries = get_gla_state_entries(&gla->states[j], entries);
+            size += get_dispatch_size(num_entries, g->num_terminals);
+        }
+
+        int *storage = gzl_arena_alloc(&g->hot, size * sizeof(*storage));
+        for(int j = 0; j < gla->num_states; j++)
+        {
+            struct gzl_gla_state *state = &gla->states[j];
+            if(state->is_final)
+                continue;
+            int num_entries = get_gla_state_entries(state, entries);
+            storage = build_dispatch(&state->d.nonfinal.dispatch, entries,
+                                     num_entries, g->num_terminals, storage);
+        }
+        grammar_free(g, entries, gla->num_transitions * sizeof(*entries));
+        build_ll1_dispatch(g, gla);
+    }
+}
+
+/*
+ * Descent chains.
+ */
+
+/* Simulates descend_to_gla() from a state with no lookahead of its own, up to
+ * the first state that has some, or a final state that would pop the frame
+ * we started from.  The steps are stored in "steps", and the deepest they
+ * take the stack in "depth".  "levels" and "pushed" are scratch space, with
+ * room for max_steps + 1 entries.  Stopping after max_steps only matters for
+ * grammars that can recurse without consuming input; descend_to_gla() picks
+ * up where the steps leave off. */
+static
+int get_descent_steps(struct gzl_rtn_state *state,
+                      struct gzl_rtn_transition **steps, int max_steps,
+                      struct gzl_rtn_state **levels,
+                      struct gzl_rtn_transition **pushed, int *depth)
+{
+    int num_steps = 0;
+    int level = 0;
+    levels[0] = state;
+    *depth = 0;
+    while(num_steps < max_steps &&
+          levels[level]->lookahead_type == GZL_STATE_HAS_NEITHER)
+    {
+        struct gzl_rtn_state *top = levels[level];
+        if(top->num_transitions == 0)
+        {
+            if(level == 0)
+                break;
+            steps[num_steps++] = NULL;
+            level--;
+            levels[level] = pushed[level]->dest_state;
+        }
+        else
+        {
+            struct gzl_rtn_transition *t = &top->transitions[0];
+            steps[num_steps++] = t;
+            pushed[level++] = t;
+            levels[level] = &t->edge.nonterminal->states[0];
+            if(level > *depth)
+                *depth = level;
+        }
+    }
+    return num_steps;
+}
+
+static
+void build_descents(struct gzl_grammar *g)
+{
+    /* Without recursion, a descent visits each state at most twice. */
+    int max_steps = 0;
+    for(int i = 0; i < g->num_rtns; i++)
+        max_steps += g->rtns[i].num_states * 2;
+
+    struct gzl_rtn_transition **steps =
+        grammar_alloc(g, max_steps * sizeof(*steps));
+    struct gzl_rtn_transition **pushed =
+        grammar_alloc(g, (max_steps + 1) * sizeof(*pushed));
+    struct gzl_rtn_state **levels =
+        grammar_alloc(g, (max_steps + 1) * sizeof(*levels));
+
+    for(int i = 0; i < g->num_rtns; i++)
+    {
+        for(int j = 0; j < g->rtns[i].num_states; j++)
+        {
+            struct gzl_rtn_state *state = &g->rtns[i].states[j];
+            state->num_descent_steps = get_descent_steps(
+                state, steps, max_steps, levels, pushed, &state->descent_depth);
+            state->descent_steps = NULL;
+            if(state->num_descent_steps > 0)
+            {
+                size_t size = state->num_descent_steps * sizeof(*steps);
+                state->descent_steps = gzl_arena_alloc(&g->hot, size);
+                memcpy(state->descent_steps, steps, size);
+            }
+        }
+    }
+
+    grammar_free(g, steps, max_steps * sizeof(*steps));
+    grammar_free(g, pushed, (max_steps + 1) * sizeof(*pushed));
+    grammar_free(g, levels, (max_steps + 1) * sizeof(*levels));
+}
+
 struct gzl_grammar *gzl_load_grammar(struct bc_read_stream *s)
 {
-    struct gzl_grammar *g = malloc(sizeof(*g));
+    return gzl_load_grammar_with_allocator(s, &gzl_default_allocator);
+}
+
+struct gzl_grammar *gzl_load_grammar_with_allocator(
+    struct bc_read_stream *s, struct gzl_allocator *allocator)
+{
+    struct gzl_grammar *g = allocator->alloc(allocator, sizeof(*g));
+    g->allocator = allocator;
+    g->strings = NULL;
+    g->num_rtns = g->num_glas = g->num_intfas = 0;
+    gzl_arena_init(&g->hot, 16 * 1024, allocator);
+    gzl_arena_init(&g->cold, 4 * 1024, allocator);
 
     while(1)
     {
@@ -509,7 +1111,7 @@ struct gzl_grammar *gzl_load_grammar(struct bc_read_stream *s)
         if(ri.record_type == StartBlock)
         {
             if(ri.id == BC_STRINGS)
-                g->strings = load_strings(s);
+                g->strings = load_strings(s, g);
             else if(ri.id == BC_INTFAS)
                 load_intfas(s, g);
             else if(ri.id == BC_GLAS)
@@ -529,6 +1131,10 @@ struct gzl_grammar *gzl_load_grammar(struct bc_read_stream *s)
             else
             {
                 /* Success -- we finished loading! */
+                assign_terminal_ids(g);
+                build_dispatch_tables(g);
+                build_descents(g);
+                gzl_build_intfa_tables(g, GZL_DEFAULT_INTFA_TABLE_BUDGET);
                 break;
             }
         }
@@ -539,35 +1145,11 @@ struct gzl_grammar *gzl_load_grammar(struct bc_read_stream *s)
 
 void gzl_free_grammar(struct gzl_grammar *g)
 {
-    for(int i = 0; g->strings[i] != NULL; i++)
-        free(g->strings[i]);
-    free(g->strings); 
-
-    for(int i = 0; i < g->num_rtns; i++)
-    {
-        struct gzl_rtn *rtn = &g->rtns[i];
-        free(rtn->states);
-        free(rtn->transitions);
-    }
-    free(g->rtns);
-
-    for(int i = 0; i < g->num_glas; i++)
-    {
-        struct gzl_gla *gla = &g->glas[i];
-        free(gla->states);
-        free(gla->transitions);
-    }
-    free(g->glas);
-
     for(int i = 0; i < g->num_intfas; i++)
-    {
-        struct gzl_intfa *intfa = &g->intfas[i];
-        free(intfa->states);
-        free(intfa->transitions);
-    }
-    free(g->intfas);
-
-    free(g);
+        free_intfa_tables(g, &g->intfas[i]);
+    gzl_arena_free(&g->hot);
+    gzl_arena_free(&g->cold);
+    g->allocator->free(g->allocator, g, sizeof(*g));
 }
 
 /*
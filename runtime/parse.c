@@ -16,10 +16,25 @@
 
 *********************************************************************/
 
+/* For madvise(), posix_fadvise() and F_SETPIPE_SZ, which -std=c99 hides. */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "gazelle/parse.h"
 
@@ -33,58 +48,161 @@ void dump_stack(struct gzl_parse_state *s, FILE *output)
     struct gzl_grammar *g = s->bound_grammar->grammar;
     for(int i = 0; i < s->parse_stack_len; i++) {
         struct gzl_parse_stack_frame *frame = &s->parse_stack[i];
-        switch(frame->frame_type) {
-            case GZL_FRAME_TYPE_RTN: {
-                struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
-                fprintf(output, "RTN: %s, ", rtn_frame->rtn->name);
-                break;
-            }
-
-            case GZL_FRAME_TYPE_GLA: {
-                struct gzl_gla_frame *gla_frame = &frame->f.gla_frame;
-                fprintf(output, "GLA: #%d, ", (int)(gla_frame->gla - g->glas));
+        switch(gzl_get_frame_type(s, frame)) {
+            case GZL_FRAME_TYPE_RTN:
+                fprintf(output, "RTN: %s, ", gzl_get_frame_rtn(s, frame)->name);
                 break;
-            }
 
-            case GZL_FRAME_TYPE_INTFA: {
-                struct gzl_intfa_frame *intfa_frame = &frame->f.intfa_frame;
-                fprintf(output, "IntFA: #%d, ", (int)(intfa_frame->intfa - g->intfas));
+            case GZL_FRAME_TYPE_GLA:
+                fprintf(output, "GLA: #%d, ", (int)frame->index);
                 break;
-            }
         }
     }
+    if(s->intfa)
+        fprintf(output, "IntFA: #%d", (int)(s->intfa - g->intfas));
     fprintf(output, "\n");
 }
 
+/*
+ * Stack frame accessors.
+ */
+
+enum gzl_frame_type gzl_get_frame_type(struct gzl_parse_state *s,
+                                       struct gzl_parse_stack_frame *frame)
+{
+    return frame->type_and_elided & 1;
+}
+
+struct gzl_offset *gzl_get_frame_start_offset(
+    struct gzl_parse_state *s, struct gzl_parse_stack_frame *frame)
+{
+    return &s->frame_offsets[frame - s->parse_stack];
+}
+
+struct gzl_rtn *gzl_get_frame_rtn(struct gzl_parse_state *s,
+                                  struct gzl_parse_stack_frame *frame)
+{
+    assert(gzl_get_frame_type(s, frame) == GZL_FRAME_TYPE_RTN);
+    return frame->state.rtn_state->rtn;
+}
+
+struct gzl_rtn_state *gzl_get_frame_rtn_state(
+    struct gzl_parse_state *s, struct gzl_parse_stack_frame *frame)
+{
+    assert(gzl_get_frame_type(s, frame) == GZL_FRAME_TYPE_RTN);
+    return frame->state.rtn_state;
+}
+
+struct gzl_rtn_transition *gzl_get_frame_rtn_transition(
+    struct gzl_parse_state *s, struct gzl_parse_stack_frame *frame)
+{
+    assert(gzl_get_frame_type(s, frame) == GZL_FRAME_TYPE_RTN);
+    if(frame->index == 0)
+        return NULL;
+    return &frame->state.rtn_state->rtn->transitions[frame->index - 1];
+}
+
+int gzl_get_frame_elided_frames(struct gzl_parse_state *s,
+                                struct gzl_parse_stack_frame *frame)
+{
+    assert(gzl_get_frame_type(s, frame) == GZL_FRAME_TYPE_RTN);
+    return frame->type_and_elided >> 1;
+}
+
+struct gzl_gla *gzl_get_frame_gla(struct gzl_parse_state *s,
+                                  struct gzl_parse_stack_frame *frame)
+{
+    assert(gzl_get_frame_type(s, frame) == GZL_FRAME_TYPE_GLA);
+    return &s->bound_grammar->grammar->glas[frame->index];
+}
+
+struct gzl_gla_state *gzl_get_frame_gla_state(
+    struct gzl_parse_state *s, struct gzl_parse_stack_frame *frame)
+{
+    assert(gzl_get_frame_type(s, frame) == GZL_FRAME_TYPE_GLA);
+    return frame->state.gla_state;
+}
+
+static
+void set_rtn_transition(struct gzl_parse_stack_frame *frame,
+                        struct gzl_rtn_transition *t)
+{
+    frame->index = t - frame->state.rtn_state->rtn->transitions + 1;
+}
+
 /*
  * The following are stack-manipulation functions.  Gazelle maintains a runtime
  * stack (which is completely separate from the C stack), and these functions
  * provide pushing and popping of different kinds of stack frames.
+ *
+ * Pushes and pops never check the stack's capacity.  Instead, anything that
+ * can make the stack deeper first calls reserve_frames(), which checks the
+ * depth limit and grows the stack if it isn't preallocated.
  */
 
 static
-struct gzl_parse_stack_frame *push_empty_frame(struct gzl_parse_state *s,
-                                               enum gzl_frame_type frame_type,
-                                               struct gzl_offset *start_offset)
+bool reserve_frames(struct gzl_parse_state *s, int n)
 {
-    RESIZE_DYNARRAY(s->parse_stack, s->parse_stack_len+1);
-    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
-    frame->frame_type = frame_type;
-    frame->start_offset = *start_offset;
-    return frame;
+    if(s->parse_stack_len + n > s->max_stack_depth)
+        return false;
+    if(s->parse_stack_len + n > s->parse_stack_size) {
+        if(s->preallocated)
+            return false;
+        struct gzl_allocator *a = s->allocator;
+        int old_size = s->parse_stack_size;
+        while(s->parse_stack_len + n > s->parse_stack_size)
+            s->parse_stack_size *= 2;
+        s->parse_stack = a->realloc(
+            a, s->parse_stack, old_size * sizeof(*s->parse_stack),
+            s->parse_stack_size * sizeof(*s->parse_stack));
+        s->frame_offsets = a->realloc(
+            a, s->frame_offsets, old_size * sizeof(*s->frame_offsets),
+            s->parse_stack_size * sizeof(*s->frame_offsets));
+    }
+    return true;
 }
 
+/* Whether a rule or terminal is selected by a mask that may be NULL (see
+ * rule_mask in struct gzl_bound_grammar). */
+#define SELECTED(mask, i) (!(mask) || GZL_MASK_TEST(mask, i))
+
+/* Hands the batched events to the client (see "events" in struct
+ * gzl_parse_state). */
 static
-struct gzl_intfa_frame *push_intfa_frame(struct gzl_parse_state *s,
-                                         struct gzl_intfa *intfa,
-                                         struct gzl_offset *start_offset)
+void flush_events(struct gzl_parse_state *s)
 {
-    struct gzl_parse_stack_frame *frame =
-        push_empty_frame(s, GZL_FRAME_TYPE_INTFA, start_offset);
-    struct gzl_intfa_frame *intfa_frame = &frame->f.intfa_frame;
-    intfa_frame->intfa        = intfa;
-    intfa_frame->intfa_state  = &intfa->states[0];
-    return intfa_frame;
+    if(s->num_events > 0) {
+        if(s->bound_grammar->events_cb)
+            s->bound_grammar->events_cb(s, s->events, s->num_events);
+        s->num_events = 0;
+    }
+}
+
+static
+void add_event(struct gzl_parse_state *s, enum gzl_event_type type, int id,
+               int slotnum, uint64_t byte, size_t len)
+{
+    assert(s->max_events > 0);
+    struct gzl_event *event = &s->events[s->num_events++];
+    event->byte = byte;
+    event->id = id;
+    event->slotnum = slotnum;
+    event->len = len;
+    event->type = type;
+    if(s->num_events >= s->max_events)
+        flush_events(s);
+}
+
+static
+struct gzl_parse_stack_frame *push_empty_frame(struct gzl_parse_state *s,
+                                               enum gzl_frame_type frame_type,
+                                               struct gzl_offset *start_offset)
+{
+    assert(s->parse_stack_len < s->parse_stack_size);
+    s->frame_offsets[s->parse_stack_len] = *start_offset;
+    struct gzl_parse_stack_frame *frame = &s->parse_stack[s->parse_stack_len++];
+    frame->type_and_elided = frame_type;
+    return frame;
 }
 
 static
@@ -94,9 +212,8 @@ struct gzl_parse_stack_frame *push_gla_frame(struct gzl_parse_state *s,
 {
     struct gzl_parse_stack_frame *frame =
         push_empty_frame(s, GZL_FRAME_TYPE_GLA, start_offset);
-    struct gzl_gla_frame *gla_frame = &frame->f.gla_frame;
-    gla_frame->gla          = gla;
-    gla_frame->gla_state    = &gla->states[0];
+    frame->state.gla_state = &gla->states[0];
+    frame->index = gla - s->bound_grammar->grammar->glas;
     return frame;
 }
 
@@ -107,11 +224,20 @@ enum gzl_status push_rtn_frame(struct gzl_parse_state *s,
 {
     struct gzl_parse_stack_frame *new_frame =
         push_empty_frame(s, GZL_FRAME_TYPE_RTN, start_offset);
-    struct gzl_rtn_frame *new_rtn_frame = &new_frame->f.rtn_frame;
-    new_rtn_frame->rtn            = rtn;
-    new_rtn_frame->rtn_transition = NULL;
-    new_rtn_frame->rtn_state      = &new_rtn_frame->rtn->states[0];
-    if(s->bound_grammar->start_rule_cb) s->bound_grammar->start_rule_cb(s);
+    new_frame->state.rtn_state = &rtn->states[0];
+    new_frame->index = 0;
+
+    struct gzl_bound_grammar *bg = s->bound_grammar;
+    int id = rtn - bg->grammar->rtns;
+    if(!SELECTED(bg->rule_mask, id))
+        return GZL_STATUS_OK;
+    if(s->events) {
+        struct gzl_rtn_transition *t = s->parse_stack_len > 1 ?
+            gzl_get_frame_rtn_transition(s, new_frame - 1) : NULL;
+        add_event(s, GZL_EVENT_START_RULE, id, t ? t->slotnum : -1,
+                  start_offset->byte, 0);
+    } else if(bg->start_rule_cb)
+        bg->start_rule_cb(s);
     return GZL_STATUS_OK;
 }
 
@@ -120,32 +246,80 @@ enum gzl_status push_rtn_frame_for_transition(struct gzl_parse_state *s,
                                               struct gzl_rtn_transition *t,
                                               struct gzl_offset *start_offset)
 {
-    struct gzl_rtn_frame *old_rtn_frame =
-        &DYNARRAY_GET_TOP(s->parse_stack)->f.rtn_frame;
-    old_rtn_frame->rtn_transition = t;
-    return push_rtn_frame(s, t->edge.nonterminal, start_offset);
+    struct gzl_parse_stack_frame *caller = DYNARRAY_GET_TOP(s->parse_stack);
+    set_rtn_transition(caller, t);
+
+    /* A caller whose rule is selected keeps its frame, so that its end event
+     * can still be reported.  With an event buffer, every caller does, so
+     * that every end event carries its rule's id. */
+    struct gzl_bound_grammar *bg = s->bound_grammar;
+    bool tail_call = s->eliminate_tail_calls && !s->events &&
+        t->dest_state->num_transitions == 0 &&
+        !(bg->rule_mask && GZL_MASK_TEST(bg->rule_mask,
+                                         gzl_get_frame_rtn(s, caller) -
+                                         bg->grammar->rtns));
+
+    enum gzl_status status = push_rtn_frame(s, t->edge.nonterminal,
+                                            start_offset);
+
+    if(tail_call) {
+        /* All that is left for the caller is to return, so the new frame
+         * takes its place.  This happens after the start_rule callback, which
+         * may want to look at the caller. */
+        struct gzl_parse_stack_frame *new_frame =
+            DYNARRAY_GET_TOP(s->parse_stack);
+        struct gzl_parse_stack_frame *old_frame = new_frame - 1;
+        assert(t->dest_state->is_final);
+        new_frame->type_and_elided = old_frame->type_and_elided + 2;
+        *old_frame = *new_frame;
+        s->frame_offsets[s->parse_stack_len - 2] =
+            s->frame_offsets[s->parse_stack_len - 1];
+        s->parse_stack_len--;
+    }
+    return status;
 }
 
 static
 struct gzl_parse_stack_frame *pop_frame(struct gzl_parse_state *s)
 {
     assert(s->parse_stack_len > 0);
-    RESIZE_DYNARRAY(s->parse_stack, s->parse_stack_len-1);
+    s->parse_stack_len--;
     return s->parse_stack_len > 0 ? DYNARRAY_GET_TOP(s->parse_stack) : NULL;
 }
 
+static
+void end_rule_event(struct gzl_parse_state *s, int id)
+{
+    if(s->events)
+        add_event(s, GZL_EVENT_END_RULE, id, 0, s->offset.byte, 0);
+    else if(s->bound_grammar->end_rule_cb)
+        s->bound_grammar->end_rule_cb(s);
+}
+
 static
 enum gzl_status pop_rtn_frame(struct gzl_parse_state *s)
 {
-    assert(DYNARRAY_GET_TOP(s->parse_stack)->frame_type == GZL_FRAME_TYPE_RTN);
-    if(s->bound_grammar->end_rule_cb) s->bound_grammar->end_rule_cb(s);
+    struct gzl_bound_grammar *bg = s->bound_grammar;
+    if(s->events || bg->end_rule_cb) {
+        struct gzl_parse_stack_frame *top = DYNARRAY_GET_TOP(s->parse_stack);
+        int id = gzl_get_frame_rtn(s, top) - bg->grammar->rtns;
+        if(SELECTED(bg->rule_mask, id))
+            end_rule_event(s, id);
+
+        /* The callers that tail calls elided end here too.  With a rule mask,
+         * they are never selected, and with an event buffer there are none. */
+        if(!bg->rule_mask && bg->end_rule_cb) {
+            int elided = gzl_get_frame_elided_frames(s, top);
+            for(int i = 0; i < elided; i++)
+                bg->end_rule_cb(s);
+        }
+    }
 
     struct gzl_parse_stack_frame *frame = pop_frame(s);
     if(frame) {
-        assert(frame->frame_type == GZL_FRAME_TYPE_RTN);
-        struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
-        if(rtn_frame->rtn_transition)
-            rtn_frame->rtn_state = rtn_frame->rtn_transition->dest_state;
+        struct gzl_rtn_transition *t = gzl_get_frame_rtn_transition(s, frame);
+        if(t)
+            frame->state.rtn_state = t->dest_state;
         else {
           /* Should only happen at the top level. */
           assert(s->parse_stack_len == 1);
@@ -158,16 +332,114 @@ enum gzl_status pop_rtn_frame(struct gzl_parse_state *s)
 static
 struct gzl_parse_stack_frame *pop_gla_frame(struct gzl_parse_state *s)
 {
-    assert(DYNARRAY_GET_TOP(s->parse_stack)->frame_type == GZL_FRAME_TYPE_GLA);
+    assert(gzl_get_frame_type(s, DYNARRAY_GET_TOP(s->parse_stack)) ==
+           GZL_FRAME_TYPE_GLA);
     return pop_frame(s);
 }
 
+/*
+ * Token buffer functions.  The token buffer is a ring buffer; tokens are
+ * numbered from the oldest one still in the buffer.
+ */
+
 static
-struct gzl_parse_stack_frame *pop_intfa_frame(struct gzl_parse_state *s)
+int get_token_index(struct gzl_parse_state *s, int i)
 {
-    assert(DYNARRAY_GET_TOP(s->parse_stack)->frame_type ==
-           GZL_FRAME_TYPE_INTFA);
-    return pop_frame(s);
+    return (s->token_buffer_head + i) & (s->token_buffer_size - 1);
+}
+
+static
+struct gzl_token *get_token(struct gzl_parse_state *s, int i)
+{
+    return &s->token_buffer[get_token_index(s, i)];
+}
+
+/* Token positions keep lines and columns in 32 bits; larger ones are
+ * stored as UINT32_MAX rather than wrapping around. */
+static
+uint32_t saturate_u32(size_t n)
+{
+    return n < UINT32_MAX ? n : UINT32_MAX;
+}
+
+static
+void get_token_offset(struct gzl_parse_state *s, int i,
+                      struct gzl_offset *offset)
+{
+    offset->byte = get_token(s, i)->byte;
+    if(s->track_lines && s->token_positions) {
+        struct gzl_token_position *pos =
+            &s->token_positions[get_token_index(s, i)];
+        offset->line = pos->line;
+        offset->column = pos->column;
+    } else {
+        offset->line = 0;
+        offset->column = 0;
+    }
+}
+
+/* Unpacks a token into the form that callbacks see. */
+static
+void get_terminal(struct gzl_parse_state *s, int i, struct gzl_terminal *term)
+{
+    struct gzl_token *tok = get_token(s, i);
+    term->id = tok->id;
+    term->len = tok->len;
+    get_token_offset(s, i, &term->offset);
+}
+
+static
+void push_token(struct gzl_parse_state *s, struct gzl_terminal *term)
+{
+    if(s->token_buffer_len == s->token_buffer_size) {
+        /* A preallocated buffer has room for max_lookahead tokens, which
+         * process_terminal() never exceeds. */
+        assert(!s->preallocated);
+
+        /* Double the buffer.  The tokens that had wrapped around to the
+         * beginning move to just past the old end. */
+        struct gzl_allocator *a = s->allocator;
+        int old_size = s->token_buffer_size;
+        s->token_buffer_size *= 2;
+        s->token_buffer = a->realloc(
+            a, s->token_buffer, old_size * sizeof(*s->token_buffer),
+            s->token_buffer_size * sizeof(*s->token_buffer));
+        if(s->token_positions)
+            s->token_positions = a->realloc(
+                a, s->token_positions, old_size * sizeof(*s->token_positions),
+                s->token_buffer_size * sizeof(*s->token_positions));
+        int wrapped = s->token_buffer_head + s->token_buffer_len - old_size;
+        if(wrapped > 0) {
+            memcpy(s->token_buffer + old_size, s->token_buffer,
+                   wrapped * sizeof(*s->token_buffer));
+            if(s->token_positions)
+                memcpy(s->token_positions + old_size, s->token_positions,
+                       wrapped * sizeof(*s->token_positions));
+        }
+    }
+
+    int i = get_token_index(s, s->token_buffer_len++);
+    struct gzl_token *tok = &s->token_buffer[i];
+    tok->byte = term->offset.byte;
+    tok->id = term->id;
+    tok->len = term->len;
+
+    if(s->track_lines) {
+        if(!s->token_positions)
+            s->token_positions = s->allocator->alloc(
+                s->allocator,
+                s->token_buffer_size * sizeof(*s->token_positions));
+        s->token_positions[i].line = saturate_u32(term->offset.line);
+        s->token_positions[i].column = saturate_u32(term->offset.column);
+    }
+}
+
+static
+void retire_tokens(struct gzl_parse_state *s, int n)
+{
+    s->token_buffer_head =
+        (s->token_buffer_head + n) & (s->token_buffer_size - 1);
+    s->token_buffer_len -= n;
 }
 
 /*
@@ -180,7 +452,8 @@ struct gzl_parse_stack_frame *pop_intfa_frame(struct gzl_parse_state *s)
  *
  * Postconditions:
  * - the current frame is an RTN frame or a GLA frame.  If a new GLA frame was
- *   entered, entered_gla is set to true.
+ *   entered, entered_gla is set to true.  An LL(1) GLA gets no frame; the RTN
+ *   frame is left on top for do_rtn_step() to take the decision.
  */
 static
 enum gzl_status descend_to_gla(struct gzl_parse_state *s, bool *entered_gla,
@@ -189,60 +462,81 @@ enum gzl_status descend_to_gla(struct gzl_parse_state *s, bool *entered_gla,
     *entered_gla = false;
     while(true) {
         struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
-        if(frame->frame_type != GZL_FRAME_TYPE_RTN) return GZL_STATUS_OK;
-
-        /* Subtract 1 because there can be one IntFA frame beyond the RTN and
-         * GLA frames this function pushes. */
-        if(s->parse_stack_len >= s->max_stack_depth-1)
-            return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+        if(gzl_get_frame_type(s, frame) != GZL_FRAME_TYPE_RTN)
+            return GZL_STATUS_OK;
 
-        struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
-        switch(rtn_frame->rtn_state->lookahead_type) {
+        struct gzl_rtn_state *rtn_state = frame->state.rtn_state;
+        switch(rtn_state->lookahead_type) {
           case GZL_STATE_HAS_INTFA:
             return GZL_STATUS_OK;
 
           case GZL_STATE_HAS_GLA:
+            if(rtn_state->d.state_gla->is_ll1)
+                return GZL_STATUS_OK;
+            if(!reserve_frames(s, 1))
+                return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
             *entered_gla = true;
-            push_gla_frame(s, rtn_frame->rtn_state->d.state_gla, start_offset);
+            push_gla_frame(s, rtn_state->d.state_gla, start_offset);
             return GZL_STATUS_OK;
 
           case GZL_STATE_HAS_NEITHER:
             /* An RTN state has neither an IntFA or a GLA in only two cases:
              * - it is a final state with no outgoing transitions
              * - it is a nonfinal state with only one transition (a nonterminal)
-             */
-            assert(rtn_frame->rtn_state->num_transitions < 2);
-            enum gzl_status status = GZL_STATUS_OK;
-            if(rtn_frame->rtn_state->num_transitions == 0)
-                status = pop_rtn_frame(s); /* Final state */
-            else if(rtn_frame->rtn_state->num_transitions == 1) {
-                assert(rtn_frame->rtn_state->transitions[0].transition_type ==
-                       GZL_NONTERM_TRANSITION);
-                status = push_rtn_frame_for_transition(
-                    s, &rtn_frame->rtn_state->transitions[0], start_offset);
+             * In the second case, the loader has worked out every push and
+             * pop it takes to get to a state that has lookahead. */
+            assert(rtn_state->num_transitions < 2);
+            if(rtn_state->num_descent_steps == 0) {
+                /* Final state */
+                enum gzl_status status = pop_rtn_frame(s);
+                if(status != GZL_STATUS_OK) return status;
+                break;
+            }
+
+            if(!reserve_frames(s, rtn_state->descent_depth))
+                return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+            for(int i = 0; i < rtn_state->num_descent_steps; i++) {
+                struct gzl_rtn_transition *t = rtn_state->descent_steps[i];
+                if(t)
+                    push_rtn_frame_for_transition(s, t, start_offset);
+                else {
+                    /* Popping a frame also pops the callers it elided, which
+                     * the following steps would otherwise pop. */
+                    i += gzl_get_frame_elided_frames(
+                        s, DYNARRAY_GET_TOP(s->parse_stack));
+                    pop_rtn_frame(s);
+                }
             }
-            if(status != GZL_STATUS_OK) return status;
             break;
         }
     }
 }
 
+/*
+ * start_intfa(): begins lexing a terminal at the current offset, with the
+ * IntFA of the RTN or GLA state on top of the stack (or of the start state of
+ * the LL(1) GLA an RTN frame is waiting on).
+ */
 static
-struct gzl_intfa_frame *push_intfa_frame_for_gla_or_rtn(
-    struct gzl_parse_state *s)
+void start_intfa(struct gzl_parse_state *s)
 {
     struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
-    if(frame->frame_type == GZL_FRAME_TYPE_GLA) {
-        struct gzl_gla_state *gla_state = frame->f.gla_frame.gla_state;
+    if(gzl_get_frame_type(s, frame) == GZL_FRAME_TYPE_GLA) {
+        struct gzl_gla_state *gla_state = frame->state.gla_state;
         assert(gla_state->is_final == false);
-        return push_intfa_frame(s, gla_state->d.nonfinal.intfa, &s->offset);
-    } else if(frame->frame_type == GZL_FRAME_TYPE_RTN) {
-        struct gzl_rtn_state *rtn_state = frame->f.rtn_frame.rtn_state;
-        assert(rtn_state->lookahead_type == GZL_STATE_HAS_INTFA);
-        return push_intfa_frame(s, rtn_state->d.state_intfa, &s->offset);
+        s->intfa = gla_state->d.nonfinal.intfa;
+    } else {
+        struct gzl_rtn_state *rtn_state = frame->state.rtn_state;
+        if(rtn_state->lookahead_type == GZL_STATE_HAS_GLA) {
+            assert(rtn_state->d.state_gla->is_ll1);
+            s->intfa = rtn_state->d.state_gla->states[0].d.nonfinal.intfa;
+        } else {
+            assert(rtn_state->lookahead_type == GZL_STATE_HAS_INTFA);
+            s->intfa = rtn_state->d.state_intfa;
+        }
     }
-    assert(false);  /* should never reach here. */
-    return NULL;
+    s->intfa_state = &s->intfa->states[0];
+    s->intfa_start_offset = s->offset;
 }
 
 static
@@ -251,53 +545,124 @@ enum gzl_status do_rtn_terminal_transition(struct gzl_parse_state *s,
                                            struct gzl_terminal *terminal)
 {
     struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
-    assert(frame->frame_type == GZL_FRAME_TYPE_RTN);
-    struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
-    rtn_frame->rtn_transition = t;
-    if(s->bound_grammar->terminal_cb)
-      s->bound_grammar->terminal_cb(s, terminal);
+    assert(gzl_get_frame_type(s, frame) == GZL_FRAME_TYPE_RTN);
+    set_rtn_transition(frame, t);
+    if(SELECTED(s->bound_grammar->terminal_mask, terminal->id)) {
+        if(s->events)
+            add_event(s, GZL_EVENT_TERMINAL, terminal->id, t->slotnum,
+                      terminal->offset.byte, terminal->len);
+        else if(s->bound_grammar->terminal_cb)
+            s->bound_grammar->terminal_cb(s, terminal);
+    }
     assert(t->transition_type == GZL_TERMINAL_TRANSITION);
-    rtn_frame->rtn_state = t->dest_state;
+    frame->state.rtn_state = t->dest_state;
     return GZL_STATUS_OK;
 }
 
+/* Returns the offset of the transition for this terminal, or -1. */
+static
+int find_dispatch_offset(struct gzl_terminal_dispatch *dispatch,
+                         int terminal_id)
+{
+    if(dispatch->dense)
+        return dispatch->offsets[terminal_id];
+
+    /* Sparse tables have fewer than GZL_DENSE_DISPATCH_MIN_TERMINALS entries,
+     * few enough that a scan of the packed IDs beats a binary search. */
+    for(int i = 0; i < dispatch->len; i++)
+        if(dispatch->terminal_ids[i] == terminal_id)
+            return dispatch->offsets[i];
+    return -1;
+}
+
 static
 struct gzl_rtn_transition *find_rtn_terminal_transition(
     struct gzl_rtn_state *rtn_state, struct gzl_terminal *terminal)
 {
-    for(int i = 0; i < rtn_state->num_transitions; i++) {
-        struct gzl_rtn_transition *t = &rtn_state->transitions[i];
-        if(t->transition_type == GZL_TERMINAL_TRANSITION &&
-           t->edge.terminal_name == terminal->name)
-            return t;
-    }
-    return NULL;
+    int offset = find_dispatch_offset(&rtn_state->dispatch, terminal->id);
+    return offset < 0 ? NULL : &rtn_state->transitions[offset];
 }
 
 static
 struct gzl_gla_transition *find_gla_transition(struct gzl_gla_state *gla_state,
-                                               char *term_name)
+                                               int term_id)
 {
-    for(int i = 0; i < gla_state->d.nonfinal.num_transitions; i++) {
-        struct gzl_gla_transition *t = &gla_state->d.nonfinal.transitions[i];
-        if(t->term == term_name)
-            return t;
-    }
-    return NULL;
+    int offset = find_dispatch_offset(&gla_state->d.nonfinal.dispatch, term_id);
+    return offset < 0 ? NULL : &gla_state->d.nonfinal.transitions[offset];
 }
 
 static
-struct gzl_intfa_transition *find_intfa_transition(
-    struct gzl_intfa_state *intfa_state, char ch)
+struct gzl_intfa_state *find_intfa_transition(struct gzl_intfa *intfa,
+                                              struct gzl_intfa_state *intfa_state,
+                                              unsigned char ch)
 {
+    /* Take the dense table if this IntFA got one at load time. */
+    if(intfa_state->next_state) {
+        uint8_t dest = intfa_state->next_state[intfa->byte_class[ch]];
+        return dest == GZL_INTFA_NO_TRANSITION ? NULL : &intfa->states[dest];
+    }
+
     for(int i = 0; i < intfa_state->num_transitions; i++) {
         struct gzl_intfa_transition *t = &intfa_state->transitions[i];
         if(ch >= t->ch_low && ch <= t->ch_high)
-            return t;
+            return t->dest_state;
     }
     return NULL;
 }
 
+/*
+ * do_rtn_step(): moves the RTN frame on top of the stack along on the given
+ * terminal.  Usually this is a terminal transition, but if the frame is
+ * waiting on an LL(1) GLA, the terminal instead picks the RTN transition to
+ * take, which may be a return or a nonterminal transition.
+ *
+ * Postconditions:
+ * - consumed is set if the terminal was used up.  If not, the terminal is
+ *   still due to the frame that is now on top of the stack.
+ */
+static
+enum gzl_status do_rtn_step(struct gzl_parse_state *s,
+                            struct gzl_terminal *term, bool *consumed)
+{
+    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
+    struct gzl_rtn_state *rtn_state = gzl_get_frame_rtn_state(s, frame);
+    struct gzl_rtn_transition *t = NULL;
+    *consumed = false;
+
+    if(rtn_state->lookahead_type == GZL_STATE_HAS_GLA) {
+        int offset = find_dispatch_offset(
+            &rtn_state->d.state_gla->ll1_dispatch, term->id);
+        if(offset == 0)
+            return pop_rtn_frame(s);
+        if(offset > 0) {
+            t = &rtn_state->transitions[offset-1];
+            if(t->transition_type == GZL_NONTERM_TRANSITION) {
+                if(!reserve_frames(s, 1))
+                    return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+                return push_rtn_frame_for_transition(s, t, &term->offset);
+            }
+            assert(t->terminal_id == term->id);
+        }
+    } else {
+        /* Skip EOF: RTNs don't process EOF as a terminal, only GLAs do. */
+        if(term->id == GZL_TERMINAL_EOF) {
+            *consumed = true;
+            return GZL_STATUS_OK;
+        }
+        t = find_rtn_terminal_transition(rtn_state, term);
+    }
+
+    if(!t) {
+        /* Parse error: terminal for which we had no RTN transition. */
+        flush_events(s);
+        if(s->bound_grammar->error_terminal_cb)
+            s->bound_grammar->error_terminal_cb(s, term);
+        return GZL_STATUS_ERROR;
+    }
+    *consumed = true;
+    return do_rtn_terminal_transition(s, t, term);
+}
+
 /*
  * do_gla_transition(): transitions a GLA frame, performing the appropriate
  * RTN transitions if this puts the GLA in a final state.
@@ -313,26 +678,30 @@ struct gzl_intfa_transition *find_intfa_transition(
  */
 static
 enum gzl_status do_gla_transition(struct gzl_parse_state *s,
-                                        struct gzl_terminal *term,
+                                        int gla_term_offset,
                                         int *rtn_term_offset)
 {
     struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
-    assert(frame->frame_type == GZL_FRAME_TYPE_GLA);
-    assert(frame->f.gla_frame.gla_state->is_final == false);
-    struct gzl_gla_state *gla_state = frame->f.gla_frame.gla_state;
+    struct gzl_gla_state *gla_state = gzl_get_frame_gla_state(s, frame);
+    assert(gla_state->is_final == false);
     struct gzl_gla_state *dest_gla_state = NULL;
 
     /* Find the transition. */
-    struct gzl_gla_transition *t = find_gla_transition(gla_state, term->name);
+    struct gzl_gla_transition *t =
+        find_gla_transition(gla_state, get_token(s, gla_term_offset)->id);
     if(!t) {
         /* Parse error: terminal for which we had no GLA transition. */
-        if(s->bound_grammar->error_terminal_cb)
-            s->bound_grammar->error_terminal_cb(s, term);
+        flush_events(s);
+        if(s->bound_grammar->error_terminal_cb) {
+            struct gzl_terminal term;
+            get_terminal(s, gla_term_offset, &term);
+            s->bound_grammar->error_terminal_cb(s, &term);
+        }
         return GZL_STATUS_ERROR;
     }
     /* Perform the transition. */
     assert(t->dest_state);
-    frame->f.gla_frame.gla_state = t->dest_state;
+    frame->state.gla_state = t->dest_state;
     dest_gla_state = t->dest_state;
 
     /* Perform appropriate actions if we're in a final state. */
@@ -345,17 +714,18 @@ enum gzl_status do_gla_transition(struct gzl_parse_state *s,
         if(offset == 0)
             status = pop_rtn_frame(s);
         else {
-            struct gzl_rtn_state *rtn_state = frame->f.rtn_frame.rtn_state;
+            struct gzl_rtn_state *rtn_state = frame->state.rtn_state;
             struct gzl_rtn_transition *t = &rtn_state->transitions[offset-1];
-            struct gzl_terminal *next_term = &s->token_buffer[*rtn_term_offset];
+            struct gzl_terminal next_term;
+            get_terminal(s, *rtn_term_offset, &next_term);
             if(t->transition_type == GZL_TERMINAL_TRANSITION) {
                 /* The transition must match what we have in the token buffer */
-                assert(next_term->name == t->edge.terminal_name);
+                assert(next_term.id == t->terminal_id);
                 (*rtn_term_offset)++;
-                status = do_rtn_terminal_transition(s, t, next_term);
+                status = do_rtn_terminal_transition(s, t, &next_term);
             } else
                 status = push_rtn_frame_for_transition(
-                    s, t, &next_term->offset);
+                    s, t, &next_term.offset);
         }
     }
     return status;
@@ -366,8 +736,6 @@ enum gzl_status do_gla_transition(struct gzl_parse_state *s,
  * triggering a series of RTN and/or GLA transitions.
  *
  * Preconditions:
- * - the current stack frame is an intfa frame representing the intfa that
- *   just produced this terminal
  * - the given terminal can be recognized by the current GLA or RTN state
  *
  * Postconditions:
@@ -376,59 +744,66 @@ enum gzl_status do_gla_transition(struct gzl_parse_state *s,
  */
 
 static
-enum gzl_status process_terminal(struct gzl_parse_state *s, char *term_name,
+enum gzl_status process_terminal(struct gzl_parse_state *s, int term_id,
                                  struct gzl_offset *start_offset, int len)
 {
-    pop_intfa_frame(s);
+    struct gzl_terminal term = {term_id, *start_offset, len};
+    enum gzl_status status = GZL_STATUS_OK;
+
+    /* With no lookahead pending, RTN frames (and the LL(1) decisions they wait
+     * on) can take the terminal straight from here.  It only needs to go into
+     * the token buffer if it reaches a GLA frame. */
+    if(s->token_buffer_len == 0) {
+        bool consumed = false;
+        while(status == GZL_STATUS_OK && !consumed &&
+              gzl_get_frame_type(s, DYNARRAY_GET_TOP(s->parse_stack)) ==
+              GZL_FRAME_TYPE_RTN) {
+            status = do_rtn_step(s, &term, &consumed);
+            if(status == GZL_STATUS_OK) {
+                bool entered_gla;
+                status = descend_to_gla(s, &entered_gla,
+                                        consumed ? &s->offset : &term.offset);
+            }
+        }
+        if(status != GZL_STATUS_OK || consumed) {
+            s->open_terminal_offset = s->offset;
+            return status;
+        }
+    }
+
     struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
     int rtn_term_offset = 0;
     int gla_term_offset = s->token_buffer_len;
 
-    RESIZE_DYNARRAY(s->token_buffer, s->token_buffer_len+1);
-    if(s->token_buffer_len >= s->max_lookahead)
+    if(s->token_buffer_len + 1 >= s->max_lookahead)
         return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
-
-    struct gzl_terminal *term = DYNARRAY_GET_TOP(s->token_buffer);
-    term->name = term_name;
-    term->offset = *start_offset;
-    term->len = len;
+    push_token(s, &term);
 
     /* Feed tokens to RTNs and GLAs until we have processed all the tokens we
      * have. */
-    enum gzl_status status = GZL_STATUS_OK;
-    enum gzl_frame_type frame_type = frame->frame_type;
+    enum gzl_frame_type frame_type = gzl_get_frame_type(s, frame);
     do {
         /* Take one terminal transition, for either an RTN or a GLA. */
         if(frame_type == GZL_FRAME_TYPE_RTN) {
-            struct gzl_terminal *rtn_term = &s->token_buffer[rtn_term_offset];
-            struct gzl_rtn_transition *t;
-            rtn_term_offset++;
-
-            if(rtn_term->name == NULL)
-                /* Skip: RTNs don't process EOF as a terminal, only GLAs do. */
-                continue;
-            t = find_rtn_terminal_transition(frame->f.rtn_frame.rtn_state,
-                                             rtn_term);
-            if(!t) {
-                /* Parse error: terminal for which we had no RTN transition. */
-                if(s->bound_grammar->error_terminal_cb)
-                    s->bound_grammar->error_terminal_cb(s, term);
-                return GZL_STATUS_ERROR;
-            }
-            status = do_rtn_terminal_transition(s, t, rtn_term);
+            bool consumed;
+            get_terminal(s, rtn_term_offset, &term);
+            status = do_rtn_step(s, &term, &consumed);
+            if(consumed)
+                rtn_term_offset++;
         } else {
-            struct gzl_terminal *gla_term = &s->token_buffer[gla_term_offset++];
-            status = do_gla_transition(s, gla_term, &rtn_term_offset);
+            status = do_gla_transition(s, gla_term_offset++, &rtn_term_offset);
         }
 
         /* Having taken a transition, push any new frames onto the stack. */
         if(status == GZL_STATUS_OK) {
             bool entered_gla;
-            if(rtn_term_offset < s->token_buffer_len)
-                status = descend_to_gla(
-                    s, &entered_gla, &s->token_buffer[rtn_term_offset].offset);
-            else
+            if(rtn_term_offset < s->token_buffer_len) {
+                struct gzl_offset start_offset;
+                get_token_offset(s, rtn_term_offset, &start_offset);
+                status = descend_to_gla(s, &entered_gla, &start_offset);
+            } else {
                 status = descend_to_gla(s, &entered_gla, &s->offset);
+            }
 
             if(entered_gla)
                 gla_term_offset = rtn_term_offset;
@@ -437,7 +812,7 @@ enum gzl_status process_terminal(struct gzl_parse_state *s, char *term_name,
         if(status == GZL_STATUS_OK) {
             assert(s->parse_stack_len > 0);
             frame = DYNARRAY_GET_TOP(s->parse_stack);
-            frame_type = frame->frame_type;
+            frame_type = gzl_get_frame_type(s, frame);
         }
     }
     while(status == GZL_STATUS_OK &&
@@ -447,10 +822,10 @@ enum gzl_status process_terminal(struct gzl_parse_state *s, char *term_name,
             gla_term_offset < s->token_buffer_len)));
 
     /* We can have an EOF left over in the token buffer if the EOF token led us
-     * to a hard EOF, thus terminating the above loop before our "skip" above
-     * could cover this EOF special case. */
+     * to a hard EOF, thus terminating the above loop before do_rtn_step()
+     * could skip it. */
     if(rtn_term_offset < s->token_buffer_len &&
-       s->token_buffer[rtn_term_offset].name == NULL)
+       get_token(s, rtn_term_offset)->id == GZL_TERMINAL_EOF)
         rtn_term_offset++;
 
     /* At this point we have consumed some (but possibly not all) of the
@@ -459,16 +834,12 @@ enum gzl_status process_terminal(struct gzl_parse_state *s, char *term_name,
      * token consumed, because it will be used again for an RTN transition
      * later.
      *
-     * We now remove the consumed terminals from token_buffer. */
-    int remaining_terminals = s->token_buffer_len - rtn_term_offset;
-    if(remaining_terminals > 0)
-        memmove(s->token_buffer, s->token_buffer + rtn_term_offset,
-                remaining_terminals * sizeof(*s->token_buffer));
-    RESIZE_DYNARRAY(s->token_buffer, remaining_terminals);
+     * We now retire the consumed terminals from token_buffer. */
+    retire_tokens(s, rtn_term_offset);
 
     /* Update open_terminal_offset. */
-    if(remaining_terminals > 0)
-        s->open_terminal_offset = s->token_buffer[0].offset;
+    if(s->token_buffer_len > 0)
+        get_token_offset(s, 0, &s->open_terminal_offset);
     else
         s->open_terminal_offset = s->offset;
 
@@ -477,136 +848,304 @@ enum gzl_status process_terminal(struct gzl_parse_state *s, char *term_name,
 
 
 /*
- * do_intfa_transition(): transitions an IntFA frame according to the given
- * char, performing the appropriate GLA/RTN transitions if this puts the IntFA
- * in a final state.
+ * Skipping runs of self-looping bytes.  Once the lexer is in an IntFA state
+ * that loops back to itself on a large or simple set of bytes (like the
+ * inside of a string literal), we can find the first byte that leaves the
+ * state many bytes at a time, and account for the bytes in between in bulk.
+ */
+
+static
+bool skip_in_ranges(struct gzl_intfa_skip *skip, unsigned char ch)
+{
+    for(int i = 0; i < skip->num_ranges; i++)
+        if(ch >= skip->low[i] && ch <= skip->high[i])
+            return true;
+    return false;
+}
+
+static
+size_t skip_scalar(struct gzl_intfa_skip *skip, unsigned char *buf,
+                   size_t len)
+{
+    size_t i;
+    for(i = 0; i < len; i++)
+        if(skip_in_ranges(skip, buf[i]) == skip->exits)
+            break;
+    return i;
+}
+
+#if defined(__AVX2__)
+static
+size_t skip_simd(struct gzl_intfa_skip *skip, unsigned char *buf, size_t len)
+{
+    __m256i low[GZL_INTFA_MAX_SKIP_RANGES];
+    __m256i span[GZL_INTFA_MAX_SKIP_RANGES];
+    __m256i zero = _mm256_setzero_si256();
+    for(int r = 0; r < skip->num_ranges; r++) {
+        low[r] = _mm256_set1_epi8(skip->low[r]);
+        span[r] = _mm256_set1_epi8(skip->high[r] - skip->low[r]);
+    }
+
+    size_t i = 0;
+    for(; i + 32 <= len; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((__m256i*)(buf + i));
+        __m256i in_ranges = zero;
+        for(int r = 0; r < skip->num_ranges; r++) {
+            /* ch is in [low, high] iff (ch - low) <= (high - low), unsigned. */
+            __m256i above = _mm256_subs_epu8(_mm256_sub_epi8(bytes, low[r]),
+                                             span[r]);
+            in_ranges = _mm256_or_si256(in_ranges,
+                                        _mm256_cmpeq_epi8(above, zero));
+        }
+        uint32_t leaving = _mm256_movemask_epi8(in_ranges);
+        if(!skip->exits) leaving = ~leaving;
+        if(leaving) return i + __builtin_ctz(leaving);
+    }
+    return i + skip_scalar(skip, buf + i, len - i);
+}
+#elif defined(__SSE2__)
+static
+size_t skip_simd(struct gzl_intfa_skip *skip, unsigned char *buf, size_t len)
+{
+    __m128i low[GZL_INTFA_MAX_SKIP_RANGES];
+    __m128i span[GZL_INTFA_MAX_SKIP_RANGES];
+    __m128i zero = _mm_setzero_si128();
+    for(int r = 0; r < skip->num_ranges; r++) {
+        low[r] = _mm_set1_epi8(skip->low[r]);
+        span[r] = _mm_set1_epi8(skip->high[r] - skip->low[r]);
+    }
+
+    size_t i = 0;
+    for(; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128((__m128i*)(buf + i));
+        __m128i in_ranges = zero;
+        for(int r = 0; r < skip->num_ranges; r++) {
+            /* ch is in [low, high] iff (ch - low) <= (high - low), unsigned. */
+            __m128i above = _mm_subs_epu8(_mm_sub_epi8(bytes, low[r]), span[r]);
+            in_ranges = _mm_or_si128(in_ranges, _mm_cmpeq_epi8(above, zero));
+        }
+        uint32_t leaving = _mm_movemask_epi8(in_ranges);
+        if(!skip->exits) leaving = ~leaving & 0xFFFF;
+        if(leaving) return i + __builtin_ctz(leaving);
+    }
+    return i + skip_scalar(skip, buf + i, len - i);
+}
+#else
+#define skip_simd skip_scalar
+#endif
+
+/*
+ * emit_terminal(): processes the terminal recognized by the current IntFA
+ * state, then starts lexing the next terminal with the IntFA for whatever
+ * RTN or GLA state that leaves us in.
  *
  * Preconditions:
- * - the current stack frame is an IntFA frame
+ * - s->offset is just past the last byte of the terminal
  *
  * Postconditions:
- * - the current stack frame is an IntFA frame unless we have hit a
- *   hard EOF in which case it is an RTN frame.  Note that it could be either
- *   same IntFA frame or a different one.
+ * - if the status is GZL_STATUS_OK, s->intfa is lexing the next terminal,
+ *   beginning at s->offset.  Otherwise s->intfa is NULL.
+ */
+static
+enum gzl_status emit_terminal(struct gzl_parse_state *s)
+{
+    int terminal = s->intfa_state->final_id;
+    assert(terminal);  /* TODO: handle this case. */
+    s->intfa = NULL;
+    enum gzl_status status = process_terminal(
+        s, terminal, &s->intfa_start_offset,
+        s->offset.byte - s->intfa_start_offset.byte);
+    if(status == GZL_STATUS_OK)
+        start_intfa(s);
+    return status;
+}
+
+/* Called after each terminal that lex() emits, with the number emitted so far
+ * in this call: whether to return GZL_STATUS_PAUSED now. */
+static
+bool pause_after_terminal(struct gzl_parse_state *s, int terminals)
+{
+    if(s->pause_requested || terminals == s->token_budget) {
+        s->pause_requested = false;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * lex(): runs the current IntFA over buf, emitting terminals (and so
+ * transitioning the RTN and GLA stack) as they are recognized.  The IntFA
+ * state and the offset are kept in locals, and only written back to s when
+ * the stack needs them.
  *
  * Note: we currently implement longest-match, assuming that the first
  * non-matching character is only one longer than the longest match.
  */
 static
-enum gzl_status do_intfa_transition(struct gzl_parse_state *s,
-                                    char ch)
+enum gzl_status lex(struct gzl_parse_state *s, unsigned char *buf, size_t len)
 {
-    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
-    assert(frame->frame_type == GZL_FRAME_TYPE_INTFA);
-    struct gzl_intfa_frame *intfa_frame = &frame->f.intfa_frame;
-    struct gzl_intfa_transition *t = find_intfa_transition(
-        intfa_frame->intfa_state, ch);
-    enum gzl_status status;
+    struct gzl_intfa *intfa = s->intfa;
+    struct gzl_intfa_state *state = s->intfa_state;
+    struct gzl_offset offset = s->offset;
+    bool last_char_was_newline = s->last_char_was_newline;
+    bool track_lines = s->track_lines;
+    enum gzl_status status = GZL_STATUS_OK;
+    int terminals = 0;
+
+    size_t i = 0;
+    while(i < len) {
+        unsigned char ch = buf[i];
+        struct gzl_intfa_state *dest_state =
+            find_intfa_transition(intfa, state, ch);
+
+        /* If this character did not have any transition, but the state we're
+         * coming from is final, then longest-match semantics say that we
+         * should return the last character's final state as the token.  But
+         * if the state we're coming from is *not* final, it's just a parse
+         * error. */
+        if(!dest_state) {
+            s->offset = offset;
+            s->last_char_was_newline = last_char_was_newline;
+            s->intfa_state = state;
+            status = emit_terminal(s);
+            if(status != GZL_STATUS_OK) return status;
+            if(pause_after_terminal(s, ++terminals))
+                return GZL_STATUS_PAUSED;
+            intfa = s->intfa;
+            state = s->intfa_state;
+            dest_state = find_intfa_transition(intfa, state, ch);
+            if(!dest_state) {
+                /* Parse error: we encountered a character for which we have
+                 * no transition. */
+                flush_events(s);
+                if(s->bound_grammar->error_char_cb)
+                    s->bound_grammar->error_char_cb(s, ch);
+                return GZL_STATUS_ERROR;
+            }
+        }
 
-    /* If this character did not have any transition, but the state we're coming
-     * from is final, then longest-match semantics say that we should return
-     * the last character's final state as the token.  But if the state we're
-     * coming from is *not* final, it's just a parse error. */
-    if(!t) {
-        char *terminal = intfa_frame->intfa_state->final;
-        assert(terminal);  /* TODO: handle this case. */
-        status = process_terminal(s, terminal, &frame->start_offset,
-                                  s->offset.byte - frame->start_offset.byte);
-        if(status != GZL_STATUS_OK) return status;
-        intfa_frame = push_intfa_frame_for_gla_or_rtn(s);
-        t = find_intfa_transition(intfa_frame->intfa_state, ch);
-        if(!t) {
-            /* Parse error: we encountered a character for which we have no
-             * transition. */
-            if(s->bound_grammar->error_char_cb)
-                s->bound_grammar->error_char_cb(s, ch);
-            return GZL_STATUS_ERROR;
-        }
-    }
-
-    /* We have finished processing transitions for the previous byte.
-     * Move on to the next byte. */
-    s->offset.byte++;
-
-    /* Deal with newlines.  This is all very single-byte-encoding specific for
-     * the moment. */
-    bool is_newline_char = (ch == 0x0A || ch == 0x0D);  /* LF and CR */
-    if(is_newline_char) {
-        if(!s->last_char_was_newline) {
-            s->offset.line++;
-            s->offset.column = 1;
+        /* We have finished processing transitions for the previous byte.
+         * Move on to the next byte. */
+        i++;
+        offset.byte++;
+
+        /* Deal with newlines.  This is all very single-byte-encoding specific
+         * for the moment. */
+        if(track_lines) {
+            bool is_newline_char = (ch == 0x0A || ch == 0x0D);  /* LF and CR */
+            if(is_newline_char) {
+                if(!last_char_was_newline) {
+                    offset.line++;
+                    offset.column = 1;
+                }
+            }
+            else
+                offset.column++;
+            last_char_was_newline = is_newline_char;
+        }
+
+        /* Do the transition. */
+        state = dest_state;
+
+        /* If the current state is final and there are no outgoing
+         * transitions, we *know* we don't have to wait any longer for the
+         * longest match.  Transition the RTN or GLA now, for more on-line
+         * behavior. */
+        if(state->final_id && state->num_transitions == 0) {
+            s->offset = offset;
+            s->last_char_was_newline = last_char_was_newline;
+            s->intfa_state = state;
+            status = emit_terminal(s);
+            if(status != GZL_STATUS_OK) return status;
+            if(pause_after_terminal(s, ++terminals))
+                return GZL_STATUS_PAUSED;
+            intfa = s->intfa;
+            state = s->intfa_state;
+        }
+
+        /* If the new state loops back to itself on the next bytes, consume as
+         * many of them as we can at once. */
+        struct gzl_intfa_skip *skip = track_lines ? &state->skip
+                                                  : &state->skip_no_lines;
+        if(skip->num_ranges > 0 && i < len) {
+            size_t skipped = skip_simd(skip, buf + i, len - i);
+            i += skipped;
+            offset.byte += skipped;
+            if(skipped > 0 && track_lines) {
+                /* When tracking lines, skipped bytes never include
+                 * newlines. */
+                offset.column += skipped;
+                last_char_was_newline = false;
+            }
         }
     }
-    else
-        s->offset.column++;
-    s->last_char_was_newline = is_newline_char;
-
-    /* Do the transition. */
-    intfa_frame->intfa_state = t->dest_state;
-
-    /* If the current state is final and there are no outgoing transitions,
-     * we *know* we don't have to wait any longer for the longest match.
-     * Transition the RTN or GLA now, for more on-line behavior. */
-    if(intfa_frame->intfa_state->final &&
-       (intfa_frame->intfa_state->num_transitions == 0)) {
-        status = process_terminal(s, intfa_frame->intfa_state->final,
-                                  &frame->start_offset,
-                                  s->offset.byte - frame->start_offset.byte);
-        if(status != GZL_STATUS_OK)
-            return status;
-        push_intfa_frame_for_gla_or_rtn(s);
-    }
-    return GZL_STATUS_OK;
-}
 
-/*
- * The rest of this file is the publicly-exposed API, documented in the
- * header file.
- */
+    s->offset = offset;
+    s->last_char_was_newline = last_char_was_newline;
+    s->intfa_state = state;
+    return status;
+}
 
-enum gzl_status gzl_parse(struct gzl_parse_state *s, char *buf, size_t buf_len)
+static
+enum gzl_status parse(struct gzl_parse_state *s, char *buf, size_t buf_len)
 {
     enum gzl_status status = GZL_STATUS_OK;
 
     /* For the first call, we need to push the initial frame and
      * descend from the starting frame until we hit an IntFA frame. */
     if(s->offset.byte == 0 && s->parse_stack_len == 0) {
+        if(!s->track_lines) {
+            s->offset.line = s->offset.column = 0;
+            s->open_terminal_offset = s->offset;
+        }
+        if(!reserve_frames(s, 1))
+            return GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
         push_rtn_frame(s, &s->bound_grammar->grammar->rtns[0], &s->offset);
         bool entered_gla;
         status = descend_to_gla(s, &entered_gla, &s->offset);
-        if(status == GZL_STATUS_OK) push_intfa_frame_for_gla_or_rtn(s);
+        if(status == GZL_STATUS_OK) start_intfa(s);
     }
     if(s->parse_stack_len == 0) {
         /* This gzl_parse_state has already hit hard EOF previously. */
         return GZL_STATUS_HARD_EOF;
     }
 
-    for(int i = 0; i < buf_len && status == GZL_STATUS_OK; i++)
-        status = do_intfa_transition(s, buf[i]);
+    /* Only lex as much of the buffer as the byte budget allows. */
+    bool over_budget = s->byte_budget && buf_len > s->byte_budget;
+    if(over_budget)
+        buf_len = s->byte_budget;
+
+    if(s->line_index)
+        gzl_line_index_add(s->line_index, buf, buf_len, s->offset.byte);
+
+    if(status != GZL_STATUS_OK)
+        return status;
+    status = lex(s, (unsigned char*)buf, buf_len);
+    if(status == GZL_STATUS_OK && over_budget)
+        status = GZL_STATUS_PAUSED;
     return status;
 }
 
-bool gzl_finish_parse(struct gzl_parse_state *s)
+static
+bool finish_parse(struct gzl_parse_state *s)
 {
-    /* First deal with an open IntFA frame if there is one.  The frame must
-     * be in a start state (in which case we back it out), a final state
-     * (in which case we recognize and process the terminal), or both (in
-     * which case we back out iff. we are in a GLA state with an EOF transition
-     * out).  */
-    struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(s->parse_stack);
-    if(frame->frame_type == GZL_FRAME_TYPE_INTFA) {
-        struct gzl_intfa_frame *intfa_frame = &frame->f.intfa_frame;
-        if(intfa_frame->intfa_state->final &&
-           intfa_frame->intfa_state == &intfa_frame->intfa->states[0]) {
+    /* First deal with the open IntFA if there is one.  It must be in a start
+     * state (in which case we back it out), a final state (in which case we
+     * recognize and process the terminal), or both (in which case we back out
+     * iff. we are in a GLA state with an EOF transition out).  */
+    if(s->intfa) {
+        struct gzl_intfa_state *start_state = &s->intfa->states[0];
+        if(s->intfa_state->final_id && s->intfa_state == start_state) {
             /* TODO: handle this case. */
             assert(false);
-        } else if(intfa_frame->intfa_state->final) {
-            process_terminal(s, intfa_frame->intfa_state->final,
-                             &frame->start_offset,
-                             s->offset.byte - frame->start_offset.byte);
-        } else if(intfa_frame->intfa_state == &intfa_frame->intfa->states[0]) {
-            /* Pop the frame like it never happened. */
-            pop_intfa_frame(s);
+        } else if(s->intfa_state->final_id) {
+            int terminal = s->intfa_state->final_id;
+            s->intfa = NULL;
+            process_terminal(s, terminal, &s->intfa_start_offset,
+                             s->offset.byte - s->intfa_start_offset.byte);
+        } else if(s->intfa_state == start_state) {
+            /* Drop the IntFA like it never happened. */
+            s->intfa = NULL;
         } else {
             /* IntFA is in neither a start nor a final state. 
              * This cannot be EOF. */
@@ -616,11 +1155,14 @@ bool gzl_finish_parse(struct gzl_parse_state *s)
 
     /* Next deal with an open GLA frame if there is one.  The frame must be in
      * a start state or have an outgoing EOF transition, else we are not at
-     * valid EOF. */
-    frame = DYNARRAY_GET_TOP(s->parse_stack);
-    if(frame->frame_type == GZL_FRAME_TYPE_GLA) {
-        struct gzl_gla_frame *gla_frame = &frame->f.gla_frame;
-        if(gla_frame->gla_state == &gla_frame->gla->states[0]) {
+     * valid EOF.  (The stack is empty if we have hit hard EOF.)  A pending
+     * LL(1) decision has no frame, and is dropped just like a GLA frame in its
+     * start state. */
+    struct gzl_parse_stack_frame *frame = s->parse_stack_len > 0 ?
+        DYNARRAY_GET_TOP(s->parse_stack) : NULL;
+    if(frame && gzl_get_frame_type(s, frame) == GZL_FRAME_TYPE_GLA) {
+        struct gzl_gla_state *gla_state = gzl_get_frame_gla_state(s, frame);
+        if(gla_state == &gzl_get_frame_gla(s, frame)->states[0]) {
             /* GLA is in a start state -- fine, we can just pop it as
              * if it never happened. */
             pop_gla_frame(s);
@@ -628,16 +1170,14 @@ bool gzl_finish_parse(struct gzl_parse_state *s)
             /* For this to still be valid EOF, this GLA state must have an
              * outgoing EOF transition, and we must take it now. */
             struct gzl_gla_transition *t =
-                find_gla_transition(gla_frame->gla_state, NULL);
+                find_gla_transition(gla_state, GZL_TERMINAL_EOF);
             if(!t) return false;
 
-            /* process_terminal() wants an IntFA frame to pop. */
-            push_empty_frame(s, GZL_FRAME_TYPE_INTFA, &s->offset);
-            process_terminal(s, NULL, &s->offset, 0);
+            process_terminal(s, GZL_TERMINAL_EOF, &s->offset, 0);
 
             /* Pop any GLA states that the previous may have pushed. */
             while(s->parse_stack_len > 0 &&
-                  DYNARRAY_GET_TOP(s->parse_stack)->frame_type !=
+                  gzl_get_frame_type(s, DYNARRAY_GET_TOP(s->parse_stack)) !=
                   GZL_FRAME_TYPE_RTN)
                 pop_frame(s);
         }
@@ -649,15 +1189,14 @@ bool gzl_finish_parse(struct gzl_parse_state *s)
     if(s->parse_stack_len > 0) { /* will be 0 if we already hit hard EOF. */
         for(int i = 0; i < s->parse_stack_len - 1; i++) {
             frame = &s->parse_stack[i];
-            assert(frame->frame_type == GZL_FRAME_TYPE_RTN);
-            struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
-            assert(rtn_frame->rtn_transition);
-            if(!rtn_frame->rtn_transition->dest_state->is_final) return false;
+            struct gzl_rtn_transition *t =
+                gzl_get_frame_rtn_transition(s, frame);
+            assert(t);
+            if(!t->dest_state->is_final) return false;
         }
 
         frame = DYNARRAY_GET_TOP(s->parse_stack);
-        struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
-        if(!rtn_frame->rtn_state->is_final) return false;
+        if(!gzl_get_frame_rtn_state(s, frame)->is_final) return false;
 
         /* We are truly in a state where EOF is ok.  Pop remaining RTN frames to
          * call callbacks appropriately. */
@@ -674,96 +1213,465 @@ bool gzl_finish_parse(struct gzl_parse_state *s)
     return true;
 }
 
+/*
+ * The rest of this file is the publicly-exposed API, documented in the
+ * header file.
+ */
+
+enum gzl_status gzl_parse(struct gzl_parse_state *s, char *buf, size_t buf_len)
+{
+    enum gzl_status status = parse(s, buf, buf_len);
+    flush_events(s);
+    return status;
+}
+
+bool gzl_finish_parse(struct gzl_parse_state *s)
+{
+    bool ok = finish_parse(s);
+    flush_events(s);
+    return ok;
+}
+
 struct gzl_parse_state *gzl_alloc_parse_state()
 {
-    struct gzl_parse_state *state = malloc(sizeof(*state));
-    INIT_DYNARRAY(state->parse_stack, 0, 16);
-    INIT_DYNARRAY(state->token_buffer, 0, 2);
+    return gzl_alloc_parse_state_with_allocator(&gzl_default_allocator);
+}
+
+struct gzl_parse_state *gzl_alloc_parse_state_with_allocator(
+    struct gzl_allocator *a)
+{
+    struct gzl_parse_state *state = a->alloc(a, sizeof(*state));
+    state->allocator = a;
+    INIT_DYNARRAY_WITH(state->parse_stack, 0, 16, a);
+    state->frame_offsets =
+        a->alloc(a, state->parse_stack_size * sizeof(*state->frame_offsets));
+    INIT_DYNARRAY_WITH(state->token_buffer, 0, 2, a);
+    state->token_buffer_head = 0;
+    state->token_positions = NULL;
+    state->preallocated = false;
+    return state;
+}
+
+/* A preallocated parse state is laid out in one block: the state itself, then
+ * the stack and its frame offsets, then the token buffer (whose size must be a
+ * power of two) and its token positions. */
+#define FIXED_ALIGN(n) (((n) + 15) & ~(size_t)15)
+
+static
+int get_fixed_token_buffer_size(int max_lookahead)
+{
+    int size = 1;
+    while(size < max_lookahead)
+        size *= 2;
+    return size;
+}
+
+static
+size_t get_fixed_stack_offset()
+{
+    return FIXED_ALIGN(sizeof(struct gzl_parse_state));
+}
+
+static
+size_t get_fixed_frame_offsets_offset(int max_stack_depth)
+{
+    return get_fixed_stack_offset() +
+        FIXED_ALIGN(max_stack_depth * sizeof(struct gzl_parse_stack_frame));
+}
+
+static
+size_t get_fixed_token_buffer_offset(int max_stack_depth)
+{
+    return get_fixed_frame_offsets_offset(max_stack_depth) +
+        FIXED_ALIGN(max_stack_depth * sizeof(struct gzl_offset));
+}
+
+static
+size_t get_fixed_token_positions_offset(int max_stack_depth,
+                                        int max_lookahead)
+{
+    return get_fixed_token_buffer_offset(max_stack_depth) +
+        FIXED_ALIGN(get_fixed_token_buffer_size(max_lookahead) *
+                    sizeof(struct gzl_token));
+}
+
+size_t gzl_fixed_parse_state_size(int max_stack_depth, int max_lookahead)
+{
+    return get_fixed_token_positions_offset(max_stack_depth, max_lookahead) +
+        get_fixed_token_buffer_size(max_lookahead) *
+        sizeof(struct gzl_token_position);
+}
+
+struct gzl_parse_state *gzl_place_fixed_parse_state(void *mem,
+                                                    int max_stack_depth,
+                                                    int max_lookahead)
+{
+    assert(max_stack_depth > 0 && max_lookahead > 0);
+    struct gzl_parse_state *state = mem;
+    state->allocator = &gzl_default_allocator;
+    state->parse_stack = (void*)((char*)mem + get_fixed_stack_offset());
+    state->parse_stack_len = 0;
+    state->parse_stack_size = max_stack_depth;
+    state->frame_offsets =
+        (void*)((char*)mem + get_fixed_frame_offsets_offset(max_stack_depth));
+    state->token_buffer =
+        (void*)((char*)mem + get_fixed_token_buffer_offset(max_stack_depth));
+    state->token_buffer_len = 0;
+    state->token_buffer_size = get_fixed_token_buffer_size(max_lookahead);
+    state->token_buffer_head = 0;
+    state->token_positions = (void*)((char*)mem +
+        get_fixed_token_positions_offset(max_stack_depth, max_lookahead));
+    state->max_stack_depth = max_stack_depth;
+    state->max_lookahead = max_lookahead;
+    state->preallocated = true;
     return state;
 }
 
+struct gzl_parse_state *gzl_alloc_fixed_parse_state(int max_stack_depth,
+                                                    int max_lookahead)
+{
+    struct gzl_allocator *a = &gzl_default_allocator;
+    void *mem = a->alloc(a, gzl_fixed_parse_state_size(max_stack_depth,
+                                                       max_lookahead));
+    return gzl_place_fixed_parse_state(mem, max_stack_depth, max_lookahead);
+}
+
 struct gzl_parse_state *gzl_dup_parse_state(struct gzl_parse_state *orig)
 {
-    struct gzl_parse_state *copy = malloc(sizeof(*copy));
+    struct gzl_allocator *a = orig->allocator;
+    struct gzl_parse_state *copy = a->alloc(a, sizeof(*copy));
     /* This erroneously copies pointers to dynarrays, but we'll fix in a sec. */
     *copy = *orig;
+    copy->preallocated = false;
 
-    INIT_DYNARRAY(copy->parse_stack, 0, 16);
-    RESIZE_DYNARRAY(copy->parse_stack, orig->parse_stack_len);
+    INIT_DYNARRAY_WITH(copy->parse_stack, 0, 16, a);
+    RESIZE_DYNARRAY_WITH(copy->parse_stack, orig->parse_stack_len, a);
     for(int i = 0; i < orig->parse_stack_len; i++)
         copy->parse_stack[i] = orig->parse_stack[i];
-
-    INIT_DYNARRAY(copy->token_buffer, 0, 2);
-    RESIZE_DYNARRAY(copy->token_buffer, orig->token_buffer_len);
-    for(int i = 0; i < orig->token_buffer_len; i++)
-        copy->token_buffer[i] = orig->token_buffer[i];
+    copy->frame_offsets =
+        a->alloc(a, copy->parse_stack_size * sizeof(*copy->frame_offsets));
+    memcpy(copy->frame_offsets, orig->frame_offsets,
+           orig->parse_stack_len * sizeof(*copy->frame_offsets));
+
+    /* Copy the whole ring, so the head stays valid. */
+    INIT_DYNARRAY_WITH(copy->token_buffer, orig->token_buffer_len,
+                       orig->token_buffer_size, a);
+    memcpy(copy->token_buffer, orig->token_buffer,
+           orig->token_buffer_size * sizeof(*copy->token_buffer));
+    if(orig->token_positions) {
+        copy->token_positions = a->alloc(
+            a, orig->token_buffer_size * sizeof(*copy->token_positions));
+        memcpy(copy->token_positions, orig->token_positions,
+               orig->token_buffer_size * sizeof(*copy->token_positions));
+    }
 
     return copy;
 }
 
 void gzl_free_parse_state(struct gzl_parse_state *s)
 {
-    FREE_DYNARRAY(s->parse_stack);
-    FREE_DYNARRAY(s->token_buffer);
-    free(s);
+    struct gzl_allocator *a = s->allocator;
+    if(s->preallocated) {
+        a->free(a, s, gzl_fixed_parse_state_size(s->parse_stack_size,
+                                                 s->token_buffer_size));
+        return;
+    }
+    FREE_DYNARRAY_WITH(s->parse_stack, a);
+    a->free(a, s->frame_offsets,
+            s->parse_stack_size * sizeof(*s->frame_offsets));
+    FREE_DYNARRAY_WITH(s->token_buffer, a);
+    a->free(a, s->token_positions,
+            s->token_buffer_size * sizeof(*s->token_positions));
+    a->free(a, s, sizeof(*s));
 }
 
-void gzl_init_parse_state(struct gzl_parse_state *s,
-                          struct gzl_bound_grammar *bg)
+void gzl_reset_parse_state(struct gzl_parse_state *s)
 {
     s->offset.byte = 0;
     s->offset.line = 1;
     s->offset.column = 1;
     s->open_terminal_offset = s->offset;
     s->last_char_was_newline = false;
+    s->intfa = NULL;
+    s->intfa_state = NULL;
+    s->parse_stack_len = 0;
+    s->token_buffer_len = 0;
+    s->token_buffer_head = 0;
+    s->num_events = 0;
+    s->pause_requested = false;
+}
+
+void gzl_init_parse_state(struct gzl_parse_state *s,
+                          struct gzl_bound_grammar *bg)
+{
+    gzl_reset_parse_state(s);
+    s->track_lines = true;
+    s->line_index = NULL;
+    s->eliminate_tail_calls = false;
+    s->events = NULL;
+    s->byte_budget = 0;
+    s->token_budget = 0;
     s->bound_grammar = bg;
-    RESIZE_DYNARRAY(s->parse_stack, 0);
-    RESIZE_DYNARRAY(s->token_buffer, 0);
 
-    /* Currently each stack frame takes 28 bytes on a 32-bit machine, so a
-     * stack depth of 500 is a modest 14kb of RAM.  500 frames of recursion is
-     * far deeper than we would expect any real text to be */
+    /* A preallocated state keeps the limits it was allocated for. */
+    if(s->preallocated)
+        return;
+
+    /* Each stack frame takes 16 bytes, plus 12 for its start offset on a
+     * 32-bit machine, so a stack depth of 500 is a modest 14kb of RAM.  500
+     * frames of recursion is far deeper than we would expect any real text to
+     * be */
     s->max_stack_depth = 500;
 
-    /* Currently each token of lookahead takes 20 bytes on a 32-bit machine, so
-     * a lookahead depth of 500 is 10kb of RAM.  Input text would have to be
-     * truly pathological to require this much lookahead. */
+    /* Each token of lookahead takes 16 bytes, plus 8 for its line and column
+     * if track_lines is set, so a lookahead depth of 500 is 12kb of RAM.
+     * Input text would have to be truly pathological to require this much
+     * lookahead. */
     s->max_lookahead = 500;
 }
 
-enum gzl_status gzl_parse_file(struct gzl_parse_state *state,
-                               FILE *file, void *user_data,
-                               int max_buffer_size)
+struct gzl_parse_state_pool *gzl_alloc_parse_state_pool()
+{
+    return gzl_alloc_parse_state_pool_with_allocator(&gzl_default_allocator);
+}
+
+struct gzl_parse_state_pool *gzl_alloc_parse_state_pool_with_allocator(
+    struct gzl_allocator *a)
+{
+    struct gzl_parse_state_pool *pool = a->alloc(a, sizeof(*pool));
+    pool->allocator = a;
+    INIT_DYNARRAY_WITH(pool->states, 0, 16, a);
+    return pool;
+}
+
+void gzl_free_parse_state_pool(struct gzl_parse_state_pool *pool)
+{
+    struct gzl_allocator *a = pool->allocator;
+    for(int i = 0; i < pool->states_len; i++)
+        gzl_free_parse_state(pool->states[i]);
+    FREE_DYNARRAY_WITH(pool->states, a);
+    a->free(a, pool, sizeof(*pool));
+}
+
+struct gzl_parse_state *gzl_take_parse_state(struct gzl_parse_state_pool *pool,
+                                             struct gzl_bound_grammar *bg)
+{
+    struct gzl_parse_state *s;
+    if(pool->states_len > 0)
+        s = pool->states[--pool->states_len];
+    else
+        s = gzl_alloc_parse_state_with_allocator(pool->allocator);
+    gzl_init_parse_state(s, bg);
+    return s;
+}
+
+void gzl_return_parse_state(struct gzl_parse_state_pool *pool,
+                            struct gzl_parse_state *s)
+{
+    RESIZE_DYNARRAY_WITH(pool->states, pool->states_len+1, pool->allocator);
+    *DYNARRAY_GET_TOP(pool->states) = s;
+}
+
+struct gzl_line_index *gzl_alloc_line_index()
+{
+    return gzl_alloc_line_index_with_allocator(&gzl_default_allocator);
+}
+
+struct gzl_line_index *gzl_alloc_line_index_with_allocator(
+    struct gzl_allocator *a)
+{
+    struct gzl_line_index *index = a->alloc(a, sizeof(*index));
+    index->allocator = a;
+    INIT_DYNARRAY_WITH(index->lines, 0, 16, a);
+    index->bytes_scanned = 0;
+    index->last_char_was_newline = false;
+    return index;
+}
+
+void gzl_free_line_index(struct gzl_line_index *index)
+{
+    struct gzl_allocator *a = index->allocator;
+    FREE_DYNARRAY_WITH(index->lines, a);
+    a->free(a, index, sizeof(*index));
+}
+
+void gzl_line_index_add(struct gzl_line_index *index, char *buf, size_t len,
+                        size_t buf_offset)
+{
+    /* The same description the lexer uses to skip to the next newline. */
+    static struct gzl_intfa_skip until_newline = {
+        .exits = true, .num_ranges = 2,
+        .low = {0x0A, 0x0D}, .high = {0x0A, 0x0D}
+    };
+
+    assert(buf_offset <= index->bytes_scanned);
+    if(buf_offset + len <= index->bytes_scanned)
+        return;
+    size_t i = index->bytes_scanned - buf_offset;
+    unsigned char *ubuf = (unsigned char*)buf;
+
+    while(i < len) {
+        if(index->last_char_was_newline) {
+            /* Extend the current newline sequence; the line's first column
+             * begins after it. */
+            while(i < len && (ubuf[i] == 0x0A || ubuf[i] == 0x0D))
+                i++;
+            DYNARRAY_GET_TOP(index->lines)->column_1_byte = buf_offset + i;
+            if(i == len)
+                break;
+            index->last_char_was_newline = false;
+        }
+
+        i += skip_simd(&until_newline, ubuf + i, len - i);
+        if(i < len) {
+            /* A newline that begins a new line. */
+            i++;
+            RESIZE_DYNARRAY_WITH(index->lines, index->lines_len+1,
+                                 index->allocator);
+            struct gzl_line_start *line = DYNARRAY_GET_TOP(index->lines);
+            line->byte = line->column_1_byte = buf_offset + i;
+            index->last_char_was_newline = true;
+        }
+    }
+
+    index->bytes_scanned = buf_offset + len;
+}
+
+void gzl_line_index_lookup(struct gzl_line_index *index,
+                           struct gzl_offset *offset)
+{
+    /* Find the number of lines that begin at or before this byte. */
+    int low = 0, high = index->lines_len;
+    while(low < high) {
+        int mid = low + (high - low) / 2;
+        if(index->lines[mid].byte <= offset->byte)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    size_t column_1_byte = low > 0 ? index->lines[low-1].column_1_byte : 0;
+    offset->line = low + 1;
+    offset->column = 1;
+    if(offset->byte > column_1_byte)
+        offset->column += offset->byte - column_1_byte;
+}
+
+/* Calls gzl_parse() until it has done all it will with buf, resuming it
+ * whenever it pauses. */
+static
+enum gzl_status parse_through_pauses(struct gzl_parse_state *s, char *buf,
+                                     size_t buf_len)
+{
+    size_t start = s->offset.byte;
+    enum gzl_status status;
+    do {
+        size_t done = s->offset.byte - start;
+        status = gzl_parse(s, buf + done, buf_len - done);
+    } while(status == GZL_STATUS_PAUSED);
+    return status;
+}
+
+enum gzl_status gzl_parse_string(struct gzl_parse_state *state,
+                                 char *buf, size_t buf_len)
+{
+    gzl_reset_parse_state(state);
+    enum gzl_status status = parse_through_pauses(state, buf, buf_len);
+    if(status == GZL_STATUS_OK || status == GZL_STATUS_HARD_EOF) {
+        if(gzl_finish_parse(state))
+            status = GZL_STATUS_OK;
+        else
+            status = GZL_STATUS_PREMATURE_EOF_ERROR;
+    }
+    return status;
+}
+
+/* gzl_parse_file() starts with reads of MIN_READ_SIZE bytes (or the file's
+ * block size, if that is larger), and doubles the read size after every
+ * read that the file fills completely, up to MAX_READ_SIZE.  Small files are
+ * read with small buffers, and large ones with few system calls. */
+#define MIN_READ_SIZE (64 * 1024)
+#define MAX_READ_SIZE (4 * 1024 * 1024)
+
+/* Makes room at the end of the buffer for a read of read_size bytes, if it
+ * can, and returns how many bytes to read (0 if the open terminals fill the
+ * whole buffer).  A fixed buffer belongs to the client, and is never resized.
+ *
+ * Bytes stay where they were read until the free space at the end of the
+ * buffer is too small for the next read.  Only then are the bytes that open
+ * terminals still need moved to the front, and the rest dropped; so most
+ * reads move nothing, and the bytes of a terminal that spans reads stay in
+ * place until it is done. */
+static
+size_t make_room(struct gzl_parse_state *state, struct gzl_buffer *buffer,
+                 bool fixed, size_t read_size, int max_buffer_size)
+{
+    if(buffer->buf_len > 0 &&
+       buffer->buf_size - buffer->buf_len < read_size) {
+        /* Drop the bytes that no open terminal needs. */
+        size_t bytes_to_discard = state->open_terminal_offset.byte -
+                                  buffer->buf_offset;
+        assert(bytes_to_discard <= buffer->buf_len);
+        memmove(buffer->buf, buffer->buf + bytes_to_discard,
+                buffer->buf_len - bytes_to_discard);
+        buffer->buf_offset += bytes_to_discard;
+        buffer->buf_len -= bytes_to_discard;
+    }
+
+    if(!fixed && buffer->buf_size - buffer->buf_len < read_size) {
+        /* Grow the buffer, as far as max_buffer_size allows. */
+        size_t new_buf_size = buffer->buf_size ? buffer->buf_size : 4096;
+        while(new_buf_size - buffer->buf_len < read_size)
+            new_buf_size *= 2;
+        if(new_buf_size > max_buffer_size)
+            new_buf_size = max_buffer_size;
+        if(new_buf_size > buffer->buf_size) {
+            if(buffer->buf)
+                buffer->buf = state->allocator->realloc(
+                    state->allocator, buffer->buf, buffer->buf_size,
+                    new_buf_size);
+            else
+                buffer->buf = state->allocator->alloc(state->allocator,
+                                                      new_buf_size);
+            buffer->buf_size = new_buf_size;
+        }
+    }
+
+    size_t bytes_to_read = buffer->buf_size - buffer->buf_len;
+    return bytes_to_read < read_size ? bytes_to_read : read_size;
+}
+
+/* Parses the file through the given buffer. */
+static
+enum gzl_status parse_file(struct gzl_parse_state *state, FILE *file,
+                           struct gzl_buffer *buffer, bool fixed,
+                           int max_buffer_size)
 {
-    struct gzl_buffer *buffer = malloc(sizeof(*buffer));
-    INIT_DYNARRAY(buffer->buf, 0, 4096);
     buffer->buf_offset = 0;
     buffer->bytes_parsed = 0;
-    buffer->user_data = user_data;
     state->user_data = buffer;
 
-    /* The minimum amount of the data in the buffer that we want to be new data
-     * each time.  This number shrinks as the amount of data we're preserving
-     * from open tokens grows.  If the number is below this number we increase
-     * our buffer size. */
-    const int min_new_data = 4000;
+    size_t read_size = MIN_READ_SIZE;
+    struct stat st;
+    if(fstat(fileno(file), &st) == 0 && st.st_blksize > read_size)
+        read_size = st.st_blksize;
+    if(fixed)
+        read_size = buffer->buf_size / 2;
+    if(read_size > max_buffer_size)
+        read_size = max_buffer_size;
+    if(read_size == 0)
+        read_size = 1;
 
     enum gzl_status status;
     bool is_eof = false;
     do {
-        /* Make sure we have space for at least min_new_data new data. */
-        size_t new_buf_size = buffer->buf_size;
-        while(buffer->buf_len + min_new_data > new_buf_size)
-          buffer->buf_size *= 2;
-        if(new_buf_size > max_buffer_size) {
+        /* The open terminals fill the whole buffer. */
+        size_t bytes_to_read = make_room(state, buffer, fixed, read_size,
+                                         max_buffer_size);
+        if(bytes_to_read == 0) {
             status = GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
             break;
         }
-        if(new_buf_size != buffer->buf_size) {
-            buffer->buf_size = new_buf_size;
-            buffer->buf = realloc(buffer->buf, new_buf_size);
-        }
-        size_t bytes_to_read = buffer->buf_size - buffer->buf_len;
 
         /* Do the I/O and check for errors. */
         size_t bytes_read = fread(buffer->buf + buffer->buf_len, 1,
@@ -775,56 +1683,391 @@ enum gzl_status gzl_parse_file(struct gzl_parse_state *state,
             } else if(feof(file)) {
                 is_eof = true;
             }
+        } else if(!fixed && read_size < MAX_READ_SIZE &&
+                  read_size * 2 <= (size_t)max_buffer_size) {
+            read_size *= 2;
         }
 
         /* Do the parse.  Start past whatever bytes we previously saved. */
         char *parse_start = buffer->buf + buffer->buf_len;
         buffer->buf_len += bytes_read;
-        status = gzl_parse(state, parse_start, bytes_read);
-
-        /* Preserve all data from tokens that haven't been returned yet:
-         *
-         *         buf                                                 size len
-         *         |                                                     |   |
-         *         v                                                     v   v
-         * Buffer: -----------------------------------------------------------
-         *         ^    ^                                   ^         ^
-         *         |    |                                   |         |
-         *  buf_offset  |                                   |  state->offset
-         *              |                                   |
-         *       previous value of                  current value of
-         *   state->open_terminal_offset       state->open_terminal_offset
-         *
-         *         |----| <-- Data we were previously saving.
-         *
-         *                 Data we should now be saving --> |------------|
-         */
+        status = parse_through_pauses(state, parse_start, bytes_read);
+    } while(status == GZL_STATUS_OK && !is_eof);
 
-        size_t bytes_to_discard = state->open_terminal_offset.byte -
-                                  buffer->buf_offset;
-        size_t bytes_to_save = buffer->buf_size - bytes_to_discard;
-        char *buf_to_save_from = buffer->buf + bytes_to_discard;
-        assert(bytes_to_discard <= buffer->buf_len);  /* hasn't overflowed. */
+    if(status == GZL_STATUS_HARD_EOF || (status == GZL_STATUS_OK && is_eof)) {
+        if(gzl_finish_parse(state))
+            status = GZL_STATUS_OK;
+        else
+            status = GZL_STATUS_PREMATURE_EOF_ERROR;
+    }
 
-        memmove(buffer->buf, buf_to_save_from, bytes_to_save);
-        buffer->buf_offset += bytes_to_discard;
-        buffer->buf_len = bytes_to_save;
+    return status;
+}
+
+enum gzl_status gzl_parse_file(struct gzl_parse_state *state,
+                               FILE *file, void *user_data,
+                               int max_buffer_size)
+{
+    struct gzl_buffer buffer;
+    INIT_DYNARRAY_WITH(buffer.buf, 0,
+                       max_buffer_size < 4096 ? max_buffer_size : 4096,
+                       state->allocator);
+    buffer.user_data = user_data;
+    enum gzl_status status =
+        parse_file(state, file, &buffer, false, max_buffer_size);
+    FREE_DYNARRAY_WITH(buffer.buf, state->allocator);
+    return status;
+}
+
+enum gzl_status gzl_parse_file_fixed(struct gzl_parse_state *state,
+                                     FILE *file, void *user_data,
+                                     char *buf, int buf_size)
+{
+    struct gzl_buffer buffer;
+    buffer.buf = buf;
+    buffer.buf_len = 0;
+    buffer.buf_size = buf_size;
+    buffer.user_data = user_data;
+    return parse_file(state, file, &buffer, true, buf_size);
+}
+
+void gzl_init_buffer(struct gzl_buffer *buffer, void *user_data)
+{
+    buffer->buf = NULL;
+    buffer->buf_len = buffer->buf_size = 0;
+    buffer->buf_offset = 0;
+    buffer->bytes_parsed = 0;
+    buffer->user_data = user_data;
+}
+
+void gzl_free_buffer(struct gzl_parse_state *state, struct gzl_buffer *buffer)
+{
+    FREE_DYNARRAY_WITH(buffer->buf, state->allocator);
+    buffer->buf = NULL;
+}
+
+enum gzl_status gzl_parse_fd(struct gzl_parse_state *state, int fd,
+                             struct gzl_buffer *buffer, int max_buffer_size)
+{
+    state->user_data = buffer;
+
+    size_t read_size = MIN_READ_SIZE;
+    struct stat st;
+    if(fstat(fd, &st) == 0) {
+        if(st.st_blksize > read_size)
+            read_size = st.st_blksize;
+#ifdef F_SETPIPE_SZ
+        /* A pipe hands over no more than it can hold at a time, which is only
+         * 64kb by default. */
+        if(S_ISFIFO(st.st_mode) && !buffer->buf)
+            fcntl(fd, F_SETPIPE_SZ, MAX_READ_SIZE);
+#endif
+    }
+    if(read_size > max_buffer_size)
+        read_size = max_buffer_size;
+    if(read_size == 0)
+        read_size = 1;
+
+    enum gzl_status status;
+    bool is_eof = false;
+    do {
+        size_t bytes_to_read = make_room(state, buffer, false, read_size,
+                                         max_buffer_size);
+        if(bytes_to_read == 0) {
+            status = GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+            break;
+        }
+
+        ssize_t bytes_read = read(fd, buffer->buf + buffer->buf_len,
+                                  bytes_to_read);
+        if(bytes_read < 0) {
+            if(errno == EINTR) {
+                status = GZL_STATUS_OK;
+                continue;
+            } else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                /* Everything that was read has been parsed, so the next call
+                 * can pick up from here. */
+                return GZL_STATUS_WOULD_BLOCK;
+            }
+            status = GZL_STATUS_IO_ERROR;
+            break;
+        } else if(bytes_read == 0) {
+            is_eof = true;
+        } else if(bytes_read == bytes_to_read && read_size < MAX_READ_SIZE &&
+                  read_size * 2 <= (size_t)max_buffer_size) {
+            read_size *= 2;
+        }
+
+        char *parse_start = buffer->buf + buffer->buf_len;
+        buffer->buf_len += bytes_read;
+        status = parse_through_pauses(state, parse_start, bytes_read);
     } while(status == GZL_STATUS_OK && !is_eof);
 
     if(status == GZL_STATUS_HARD_EOF || (status == GZL_STATUS_OK && is_eof)) {
-        if(gzl_finish_parse(state)) {
-            if(!feof(file) || buffer->buf_len > 0) {
-                /* There was data left over -- we hit grammar EOF before
-                 * file EOF. */
-                status = GZL_STATUS_OK;
-            } else
-                status = GZL_STATUS_PREMATURE_EOF_ERROR;
-        } else
+        if(gzl_finish_parse(state))
+            status = GZL_STATUS_OK;
+        else
+            status = GZL_STATUS_PREMATURE_EOF_ERROR;
+    }
+
+    return status;
+}
+
+/*
+ * gzl_parse_file_read_ahead(): a reader thread fills one buffer while the
+ * parser works through the other.  Each buffer has room before its data for
+ * the bytes of the terminals that are still open when the parser gets to it,
+ * which the parser copies over from the previous buffer, so that every
+ * buffer the callbacks see is contiguous from the first open terminal on.
+ */
+
+struct read_ahead
+{
+    FILE *file;
+    size_t read_size;
+
+    /* Buffer i holds carry[i] bytes of room, then up to read_size bytes of
+     * data.  While full[i] is set, the buffer belongs to the parser, and the
+     * rest of the fields for it say what the reader found. */
+    char *bufs[2];
+    size_t carry[2];
+    size_t len[2];
+    bool full[2];
+    bool last[2];   /* the reader hit EOF or an error with this buffer */
+    bool error[2];
+
+    bool stop;      /* set by the parser when it wants no more data */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static
+void *read_ahead_thread(void *arg)
+{
+    struct read_ahead *ra = arg;
+    for(int i = 0; ; i ^= 1) {
+        pthread_mutex_lock(&ra->mutex);
+        while(ra->full[i] && !ra->stop)
+            pthread_cond_wait(&ra->cond, &ra->mutex);
+        char *dest = ra->bufs[i] + ra->carry[i];
+        bool stop = ra->stop;
+        pthread_mutex_unlock(&ra->mutex);
+        if(stop)
+            break;
+
+        size_t len = fread(dest, 1, ra->read_size, ra->file);
+
+        pthread_mutex_lock(&ra->mutex);
+        ra->len[i] = len;
+        ra->last[i] = len < ra->read_size;
+        ra->error[i] = ferror(ra->file);
+        ra->full[i] = true;
+        pthread_cond_broadcast(&ra->cond);
+        pthread_mutex_unlock(&ra->mutex);
+        if(len < ra->read_size)
+            break;
+    }
+    return NULL;
+}
+
+enum gzl_status gzl_parse_file_read_ahead(struct gzl_parse_state *state,
+                                          FILE *file, void *user_data,
+                                          int max_buffer_size)
+{
+    struct gzl_allocator *allocator = state->allocator;
+    struct read_ahead ra;
+    ra.file = file;
+    ra.read_size = max_buffer_size / 2;
+    if(ra.read_size > MAX_READ_SIZE)
+        ra.read_size = MAX_READ_SIZE;
+    if(ra.read_size == 0)
+        ra.read_size = 1;
+    for(int i = 0; i < 2; i++) {
+        /* Room for the open terminals is made as it is needed. */
+        ra.carry[i] = ra.read_size < 8192 ? (ra.read_size + 1) / 2 : 4096;
+        ra.bufs[i] = allocator->alloc(allocator, ra.carry[i] + ra.read_size);
+        ra.full[i] = false;
+    }
+    ra.stop = false;
+    pthread_mutex_init(&ra.mutex, NULL);
+    pthread_cond_init(&ra.cond, NULL);
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fileno(file), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, read_ahead_thread, &ra) != 0) {
+        /* Without a thread, just read and parse in turn. */
+        for(int i = 0; i < 2; i++)
+            allocator->free(allocator, ra.bufs[i],
+                            ra.carry[i] + ra.read_size);
+        pthread_mutex_destroy(&ra.mutex);
+        pthread_cond_destroy(&ra.cond);
+        return gzl_parse_file(state, file, user_data, max_buffer_size);
+    }
+
+    struct gzl_buffer buffer;
+    buffer.buf = NULL;
+    buffer.buf_len = buffer.buf_size = 0;
+    buffer.buf_offset = 0;
+    buffer.bytes_parsed = 0;
+    buffer.user_data = user_data;
+    state->user_data = &buffer;
+
+    enum gzl_status status;
+    bool is_eof = false;
+    for(int i = 0; ; i ^= 1) {
+        pthread_mutex_lock(&ra.mutex);
+        while(!ra.full[i])
+            pthread_cond_wait(&ra.cond, &ra.mutex);
+        pthread_mutex_unlock(&ra.mutex);
+        if(ra.error[i]) {
+            status = GZL_STATUS_IO_ERROR;
+            break;
+        }
+
+        /* Carry the bytes of the open terminals over from the previous
+         * buffer, making room for them if there is not enough. */
+        size_t open_len = buffer.buf_offset + buffer.buf_len -
+                          state->open_terminal_offset.byte;
+        if(open_len > ra.carry[i]) {
+            size_t new_carry = ra.carry[i];
+            while(new_carry < open_len)
+                new_carry *= 2;
+            if(open_len + ra.read_size > (size_t)max_buffer_size) {
+                status = GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+                break;
+            }
+            char *new_buf = allocator->alloc(allocator,
+                                             new_carry + ra.read_size);
+            memcpy(new_buf + new_carry, ra.bufs[i] + ra.carry[i], ra.len[i]);
+            allocator->free(allocator, ra.bufs[i], ra.carry[i] + ra.read_size);
+            ra.bufs[i] = new_buf;
+            ra.carry[i] = new_carry;
+        }
+        char *data = ra.bufs[i] + ra.carry[i];
+        if(open_len > 0)
+            memcpy(data - open_len, buffer.buf + buffer.buf_len - open_len,
+                   open_len);
+
+        /* The previous buffer, if any, can go back to the reader. */
+        if(buffer.buf) {
+            pthread_mutex_lock(&ra.mutex);
+            ra.full[i ^ 1] = false;
+            pthread_cond_broadcast(&ra.cond);
+            pthread_mutex_unlock(&ra.mutex);
+        }
+
+        buffer.buf = data - open_len;
+        buffer.buf_offset = state->open_terminal_offset.byte;
+        buffer.buf_len = buffer.buf_size = open_len + ra.len[i];
+        status = parse_through_pauses(state, data, ra.len[i]);
+        if(ra.last[i]) {
+            is_eof = true;
+            break;
+        }
+        if(status != GZL_STATUS_OK)
+            break;
+    }
+
+    /* The reader may be waiting for a buffer, or still reading one. */
+    pthread_mutex_lock(&ra.mutex);
+    ra.stop = true;
+    pthread_cond_broadcast(&ra.cond);
+    pthread_mutex_unlock(&ra.mutex);
+    pthread_join(thread, NULL);
+
+    if(status == GZL_STATUS_HARD_EOF || (status == GZL_STATUS_OK && is_eof)) {
+        if(gzl_finish_parse(state))
+            status = GZL_STATUS_OK;
+        else
+            status = GZL_STATUS_PREMATURE_EOF_ERROR;
+    }
+
+    for(int i = 0; i < 2; i++)
+        allocator->free(allocator, ra.bufs[i], ra.carry[i] + ra.read_size);
+    pthread_mutex_destroy(&ra.mutex);
+    pthread_cond_destroy(&ra.cond);
+    return status;
+}
+
+/* gzl_parse_mmap() parses the mapping this many bytes at a time, and after
+ * each piece releases the pages that no open terminal needs any more. */
+#define MMAP_WINDOW_SIZE (16 * 1024 * 1024)
+
+enum gzl_status gzl_parse_mmap(struct gzl_parse_state *state,
+                               const char *path, void *user_data)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return GZL_STATUS_IO_ERROR;
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        close(fd);
+        return GZL_STATUS_IO_ERROR;
+    }
+
+    /* Only a regular file's size tells us how much there is to map. */
+    if(!S_ISREG(st.st_mode)) {
+        close(fd);
+        errno = ENODEV;
+        return GZL_STATUS_IO_ERROR;
+    }
+
+    /* mmap() refuses empty mappings, but an empty file is simply no input. */
+    size_t size = st.st_size;
+    char *map = NULL;
+    if(size > 0) {
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED) {
+            close(fd);
+            return GZL_STATUS_IO_ERROR;
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    /* The buffer the callbacks see begins at the first page we still have
+     * and ends with the window being parsed. */
+    struct gzl_buffer buffer;
+    buffer.buf = map;
+    buffer.buf_len = buffer.buf_size = 0;
+    buffer.buf_offset = 0;
+    buffer.bytes_parsed = 0;
+    buffer.user_data = user_data;
+    state->user_data = &buffer;
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t parsed = 0;
+    enum gzl_status status;
+    do {
+        size_t len = size - parsed;
+        if(len > MMAP_WINDOW_SIZE)
+            len = MMAP_WINDOW_SIZE;
+        buffer.buf = map + buffer.buf_offset;
+        buffer.buf_len = buffer.buf_size = parsed + len - buffer.buf_offset;
+        status = parse_through_pauses(state, map + parsed, len);
+        parsed += len;
+
+        /* Give back the pages before the first open terminal. */
+        size_t keep_from = state->open_terminal_offset.byte & ~(page_size - 1);
+        if(keep_from > buffer.buf_offset) {
+            madvise(map + buffer.buf_offset, keep_from - buffer.buf_offset,
+                    MADV_DONTNEED);
+            buffer.buf_offset = keep_from;
+        }
+    } while(parsed < size && status == GZL_STATUS_OK);
+
+    if(status == GZL_STATUS_HARD_EOF || status == GZL_STATUS_OK) {
+        if(gzl_finish_parse(state))
+            status = GZL_STATUS_OK;
+        else
             status = GZL_STATUS_PREMATURE_EOF_ERROR;
     }
 
-    FREE_DYNARRAY(buffer->buf);
-    free(buffer);
+    if(map)
+        munmap(map, size);
     return status;
 }
 
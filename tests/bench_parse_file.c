@@ -0,0 +1,194 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  bench_parse_file.c
+
+  Times gzl_parse_file() against the way it used to read files: with
+  reads of whatever space was left in the buffer, and a memmove of the
+  open terminals to the front of the buffer after every read.  The old
+  loop is reproduced here on top of gzl_parse(), so the two can be
+  compared on any grammar and input.
+
+  Usage: bench_parse_file <grammar.gzc> <input file> [runs]
+
+  Each way parses the input the given number of times (5 by default),
+  and the best time is reported.  The input must parse successfully
+  with the grammar.
+
+*********************************************************************/
+
+/* For clock_gettime(). */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gazelle/parse.h"
+
+#define MAX_BUFFER_SIZE (8 * 1024 * 1024)
+
+static long num_terminals;
+
+static
+void terminal_callback(struct gzl_parse_state *s, struct gzl_terminal *term)
+{
+    num_terminals++;
+}
+
+/* gzl_parse_file() as it was before reads went into a sliding buffer. */
+static
+enum gzl_status old_parse_file(struct gzl_parse_state *state, FILE *file)
+{
+    struct gzl_buffer buffer;
+    buffer.buf_len = 0;
+    buffer.buf_size = 4096;
+    buffer.buf = malloc(buffer.buf_size);
+    buffer.buf_offset = 0;
+    buffer.bytes_parsed = 0;
+    buffer.user_data = NULL;
+    state->user_data = &buffer;
+
+    /* Grow the buffer whenever less than this much of it is free. */
+    const int min_new_data = 4000;
+
+    enum gzl_status status;
+    bool is_eof = false;
+    do {
+        size_t new_buf_size = buffer.buf_size;
+        while(buffer.buf_len + min_new_data > new_buf_size)
+            new_buf_size *= 2;
+        if(new_buf_size > MAX_BUFFER_SIZE) {
+            status = GZL_STATUS_RESOURCE_LIMIT_EXCEEDED;
+            break;
+        }
+        if(new_buf_size != buffer.buf_size) {
+            buffer.buf = realloc(buffer.buf, new_buf_size);
+            buffer.buf_size = new_buf_size;
+        }
+
+        size_t bytes_to_read = buffer.buf_size - buffer.buf_len;
+        size_t bytes_read = fread(buffer.buf + buffer.buf_len, 1,
+                                  bytes_to_read, file);
+        if(bytes_read < bytes_to_read) {
+            if(ferror(file)) {
+                status = GZL_STATUS_IO_ERROR;
+                break;
+            }
+            is_eof = true;
+        }
+
+        char *parse_start = buffer.buf + buffer.buf_len;
+        buffer.buf_len += bytes_read;
+        size_t start = state->offset.byte;
+        do {
+            size_t done = state->offset.byte - start;
+            status = gzl_parse(state, parse_start + done, bytes_read - done);
+        } while(status == GZL_STATUS_PAUSED);
+
+        /* Move the open terminals to the front of the buffer. */
+        size_t bytes_to_discard = state->open_terminal_offset.byte -
+                                  buffer.buf_offset;
+        size_t bytes_to_save = buffer.buf_len - bytes_to_discard;
+        memmove(buffer.buf, buffer.buf + bytes_to_discard, bytes_to_save);
+        buffer.buf_offset += bytes_to_discard;
+        buffer.buf_len = bytes_to_save;
+    } while(status == GZL_STATUS_OK && !is_eof);
+
+    if(status == GZL_STATUS_HARD_EOF || (status == GZL_STATUS_OK && is_eof))
+        status = gzl_finish_parse(state) ?
+            GZL_STATUS_OK : GZL_STATUS_PREMATURE_EOF_ERROR;
+    free(buffer.buf);
+    return status;
+}
+
+static
+enum gzl_status new_parse_file(struct gzl_parse_state *state, FILE *file)
+{
+    return gzl_parse_file(state, file, NULL, MAX_BUFFER_SIZE);
+}
+
+static
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns the best time in seconds, or a negative number if a parse fails. */
+static
+double bench(enum gzl_status (*parse_file)(struct gzl_parse_state*, FILE*),
+             struct gzl_bound_grammar *bg, const char *path, int runs)
+{
+    double best = -1;
+    struct gzl_parse_state *s = gzl_alloc_parse_state();
+    for(int i = 0; i < runs; i++) {
+        FILE *file = fopen(path, "rb");
+        if(!file)
+            return -1;
+        gzl_init_parse_state(s, bg);
+        num_terminals = 0;
+        double start = now();
+        enum gzl_status status = parse_file(s, file);
+        double t = now() - start;
+        fclose(file);
+        if(status != GZL_STATUS_OK) {
+            best = -1;
+            break;
+        }
+        if(best < 0 || t < best)
+            best = t;
+    }
+    gzl_free_parse_state(s);
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc != 3 && argc != 4) {
+        fprintf(stderr,
+                "Usage: bench_parse_file <grammar.gzc> <input> [runs]\n");
+        return 1;
+    }
+    int runs = argc == 4 ? atoi(argv[3]) : 5;
+
+    struct bc_read_stream *stream = bc_rs_open_file(argv[1]);
+    if(!stream) {
+        fprintf(stderr, "bench_parse_file: couldn't open %s\n", argv[1]);
+        return 1;
+    }
+    struct gzl_grammar *g = gzl_load_grammar(stream);
+    bc_rs_close_stream(stream);
+
+    struct gzl_bound_grammar bg = {
+        .grammar = g,
+        .terminal_cb = terminal_callback,
+    };
+
+    double old_time = bench(old_parse_file, &bg, argv[2], runs);
+    long old_terminals = num_terminals;
+    double new_time = bench(new_parse_file, &bg, argv[2], runs);
+    gzl_free_grammar(g);
+
+    if(old_time < 0 || new_time < 0 || num_terminals != old_terminals) {
+        fprintf(stderr, "bench_parse_file: couldn't parse %s\n", argv[2]);
+        return 1;
+    }
+    printf("%s: %ld terminals, best of %d runs\n", argv[2], num_terminals,
+           runs);
+    printf("  old read loop:    %8.1f ms\n", old_time * 1000);
+    printf("  gzl_parse_file(): %8.1f ms\n", new_time * 1000);
+    return 0;
+}
+
+/*
+ * Local Variables:
+ * c-file-style: "bsd"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:et:sts=4:sw=4
+ */
@@ -0,0 +1,208 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  test_parse_file.c
+
+  Checks that gzl_parse_file(), gzl_parse_file_fixed(),
+  gzl_parse_file_read_ahead() and gzl_parse_fd() hand the callbacks the
+  right text for every terminal, however the reads and the buffer
+  divide up the input.  Small buffers and buffer limits make terminals
+  straddle reads, and make the buffer both compact and grow.  A
+  non-blocking pipe that is fed a few bytes at a time makes
+  gzl_parse_fd() stop and resume.
+
+  Usage: test_parse_file <grammar.gzc> <input file>
+
+  The input must parse successfully with the grammar, and the open
+  terminals (a terminal and any lookahead past it) may never span more
+  than 32 bytes.
+
+*********************************************************************/
+
+/* For pipe() and fcntl(). */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gazelle/parse.h"
+
+static char input[1024 * 1024];
+static size_t input_len;
+
+/* What the terminal callback has seen. */
+static int num_terminals;
+static unsigned long terminal_hash;
+static bool text_ok;
+
+static
+void terminal_callback(struct gzl_parse_state *s, struct gzl_terminal *term)
+{
+    struct gzl_buffer *buffer = s->user_data;
+    num_terminals++;
+    terminal_hash = terminal_hash * 31 + term->id;
+    terminal_hash = terminal_hash * 31 + term->offset.byte;
+    terminal_hash = terminal_hash * 31 + term->len;
+
+    /* gzl_parse_string() leaves user_data alone; the file functions point it
+     * at their buffer. */
+    if(!buffer)
+        return;
+    if(term->offset.byte < buffer->buf_offset ||
+       term->offset.byte + term->len > buffer->buf_offset + buffer->buf_len ||
+       memcmp(buffer->buf + (term->offset.byte - buffer->buf_offset),
+              input + term->offset.byte, term->len) != 0)
+        text_ok = false;
+}
+
+static int failures;
+
+static
+void check(bool ok, const char *what, int size)
+{
+    if(!ok) {
+        fprintf(stderr, "test_parse_file: FAILED: %s (size %d)\n", what, size);
+        failures++;
+    }
+}
+
+static
+void start(struct gzl_parse_state *s, struct gzl_bound_grammar *bg)
+{
+    gzl_init_parse_state(s, bg);
+    num_terminals = 0;
+    terminal_hash = 0;
+    text_ok = true;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc != 3) {
+        fprintf(stderr, "Usage: test_parse_file <grammar.gzc> <input>\n");
+        return 1;
+    }
+
+    struct bc_read_stream *stream = bc_rs_open_file(argv[1]);
+    if(!stream) {
+        fprintf(stderr, "test_parse_file: couldn't open %s\n", argv[1]);
+        return 1;
+    }
+    struct gzl_grammar *g = gzl_load_grammar(stream);
+    bc_rs_close_stream(stream);
+
+    FILE *file = fopen(argv[2], "rb");
+    if(!file) {
+        fprintf(stderr, "test_parse_file: couldn't open %s\n", argv[2]);
+        return 1;
+    }
+    input_len = fread(input, 1, sizeof(input), file);
+
+    struct gzl_bound_grammar bg = {
+        .grammar = g,
+        .terminal_cb = terminal_callback,
+    };
+    struct gzl_parse_state *s = gzl_alloc_parse_state();
+
+    /* The terminals as gzl_parse_string() sees them, all in one buffer. */
+    start(s, &bg);
+    s->user_data = NULL;
+    check(gzl_parse_string(s, input, input_len) == GZL_STATUS_OK,
+          "gzl_parse_string() succeeds", 0);
+    int expected_terminals = num_terminals;
+    unsigned long expected_hash = terminal_hash;
+
+    int sizes[] = {33, 34, 47, 64, 100, 257, 1000, 4096, 1024 * 1024};
+    for(int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        /* A buffer that may grow as far as the limit. */
+        rewind(file);
+        start(s, &bg);
+        enum gzl_status status = gzl_parse_file(s, file, NULL, sizes[i]);
+        check(status == GZL_STATUS_OK, "gzl_parse_file() succeeds", sizes[i]);
+        check(num_terminals == expected_terminals &&
+              terminal_hash == expected_hash,
+              "gzl_parse_file() yields the same terminals", sizes[i]);
+        check(text_ok, "gzl_parse_file() has the terminals' text", sizes[i]);
+
+        /* A buffer of exactly this size. */
+        char *buf = malloc(sizes[i]);
+        rewind(file);
+        start(s, &bg);
+        status = gzl_parse_file_fixed(s, file, NULL, buf, sizes[i]);
+        check(status == GZL_STATUS_OK, "gzl_parse_file_fixed() succeeds",
+              sizes[i]);
+        check(num_terminals == expected_terminals &&
+              terminal_hash == expected_hash,
+              "gzl_parse_file_fixed() yields the same terminals", sizes[i]);
+        check(text_ok, "gzl_parse_file_fixed() has the terminals' text",
+              sizes[i]);
+        free(buf);
+
+        /* A reader thread, which hands buffers over at read_size (half the
+         * limit); each handover must carry the open terminals along. */
+        if(sizes[i] < 64)
+            continue;
+        rewind(file);
+        start(s, &bg);
+        status = gzl_parse_file_read_ahead(s, file, NULL, sizes[i]);
+        check(status == GZL_STATUS_OK, "gzl_parse_file_read_ahead() succeeds",
+              sizes[i]);
+        check(num_terminals == expected_terminals &&
+              terminal_hash == expected_hash,
+              "gzl_parse_file_read_ahead() yields the same terminals",
+              sizes[i]);
+        check(text_ok, "gzl_parse_file_read_ahead() has the terminals' text",
+              sizes[i]);
+
+        /* A non-blocking pipe, written to 7 bytes at a time. */
+        int fds[2];
+        if(pipe(fds) != 0) {
+            check(false, "pipe() succeeds", sizes[i]);
+            continue;
+        }
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        struct gzl_buffer buffer;
+        gzl_init_buffer(&buffer, NULL);
+        start(s, &bg);
+        status = gzl_parse_fd(s, fds[0], &buffer, sizes[i]);
+        bool would_block = status == GZL_STATUS_WOULD_BLOCK;
+        for(size_t j = 0; j < input_len && status == GZL_STATUS_WOULD_BLOCK;
+            j += 7) {
+            size_t n = input_len - j < 7 ? input_len - j : 7;
+            if(write(fds[1], input + j, n) != n)
+                break;
+            status = gzl_parse_fd(s, fds[0], &buffer, sizes[i]);
+        }
+        close(fds[1]);
+        if(status == GZL_STATUS_WOULD_BLOCK)
+            status = gzl_parse_fd(s, fds[0], &buffer, sizes[i]);
+        close(fds[0]);
+        gzl_free_buffer(s, &buffer);
+        check(would_block, "gzl_parse_fd() waits for data", sizes[i]);
+        check(status == GZL_STATUS_OK, "gzl_parse_fd() succeeds", sizes[i]);
+        check(num_terminals == expected_terminals &&
+              terminal_hash == expected_hash,
+              "gzl_parse_fd() yields the same terminals", sizes[i]);
+        check(text_ok, "gzl_parse_fd() has the terminals' text", sizes[i]);
+    }
+
+    fclose(file);
+    gzl_free_parse_state(s);
+    gzl_free_grammar(g);
+
+    if(failures == 0)
+        printf("test_parse_file: all tests passed.\n");
+    return failures == 0 ? 0 : 1;
+}
+
+/*
+ * Local Variables:
+ * c-file-style: "bsd"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:et:sts=4:sw=4
+ */
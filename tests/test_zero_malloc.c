@@ -0,0 +1,245 @@
+/*********************************************************************
+
+  Gazelle: a system for building fast, reusable parsers
+
+  test_zero_malloc.c
+
+  Checks that parsing with a preallocated parse state (and, for
+  gzl_parse_file_fixed(), a client buffer) calls neither malloc nor
+  realloc, and that such a state can use all of its stack depth.
+  This file replaces malloc and friends for the whole process with a
+  simple counting allocator.
+
+  Usage: test_zero_malloc <grammar.gzc> <input file>
+
+  The input must parse successfully with the grammar, and its most
+  deeply nested rule must be reached without GLA lookahead.
+
+*********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gazelle/parse.h"
+
+/*
+ * The allocator.  Memory is carved out of a static heap and never reused;
+ * each block is preceded by its size so that realloc can copy it.
+ */
+
+static char heap[64 * 1024 * 1024];
+static size_t heap_used;
+static bool counting;
+static int num_allocs;
+
+struct block_header
+{
+    size_t size;
+    size_t pad;  /* keeps blocks 16-byte aligned */
+};
+
+void *malloc(size_t size)
+{
+    if(counting)
+        num_allocs++;
+    size = (size + 15) & ~(size_t)15;
+    if(heap_used + sizeof(struct block_header) + size > sizeof(heap))
+        return NULL;
+    struct block_header *header = (void*)(heap + heap_used);
+    header->size = size;
+    heap_used += sizeof(struct block_header) + size;
+    return header + 1;
+}
+
+void *calloc(size_t n, size_t size)
+{
+    void *mem = malloc(n * size);
+    if(mem)
+        memset(mem, 0, n * size);
+    return mem;
+}
+
+void *realloc(void *mem, size_t size)
+{
+    if(counting)
+        num_allocs++;
+    bool was_counting = counting;
+    counting = false;
+    void *new_mem = malloc(size);
+    counting = was_counting;
+    if(mem && new_mem) {
+        struct block_header *header = (struct block_header*)mem - 1;
+        memcpy(new_mem, mem, header->size < size ? header->size : size);
+    }
+    return new_mem;
+}
+
+void free(void *mem)
+{
+}
+
+/*
+ * The tests.
+ */
+
+static int num_terminals;
+static int max_depth;
+
+static
+void terminal_callback(struct gzl_parse_state *s, struct gzl_terminal *term)
+{
+    num_terminals++;
+}
+
+static
+void start_rule_callback(struct gzl_parse_state *s)
+{
+    if(s->parse_stack_len > max_depth)
+        max_depth = s->parse_stack_len;
+}
+
+static int failures;
+
+static
+void check(bool ok, const char *what)
+{
+    if(!ok) {
+        fprintf(stderr, "test_zero_malloc: FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+/* Parses the input in pieces of the given size, which exercises the lexer's
+ * handling of terminals that span calls to gzl_parse(). */
+static
+bool parse_in_pieces(struct gzl_parse_state *s, char *input, size_t len,
+                     size_t piece_len)
+{
+    enum gzl_status status = GZL_STATUS_OK;
+    for(size_t i = 0; i < len && status == GZL_STATUS_OK; i += piece_len) {
+        size_t n = len - i < piece_len ? len - i : piece_len;
+        status = gzl_parse(s, input + i, n);
+    }
+    if(status != GZL_STATUS_OK && status != GZL_STATUS_HARD_EOF)
+        return false;
+    return gzl_finish_parse(s);
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc != 3) {
+        fprintf(stderr, "Usage: test_zero_malloc <grammar.gzc> <input>\n");
+        return 1;
+    }
+
+    struct bc_read_stream *stream = bc_rs_open_file(argv[1]);
+    if(!stream) {
+        fprintf(stderr, "test_zero_malloc: couldn't open %s\n", argv[1]);
+        return 1;
+    }
+    struct gzl_grammar *g = gzl_load_grammar(stream);
+    bc_rs_close_stream(stream);
+
+    FILE *file = fopen(argv[2], "rb");
+    if(!file) {
+        fprintf(stderr, "test_zero_malloc: couldn't open %s\n", argv[2]);
+        return 1;
+    }
+    static char input[1024 * 1024];
+    size_t len = fread(input, 1, sizeof(input), file);
+
+    struct gzl_bound_grammar bg = {
+        .grammar = g,
+        .terminal_cb = terminal_callback,
+        .start_rule_cb = start_rule_callback,
+    };
+
+    /* A state the runtime allocates, and one in memory we provide. */
+    struct gzl_parse_state *s = gzl_alloc_fixed_parse_state(500, 500);
+    static char mem[256 * 1024];
+    check(gzl_fixed_parse_state_size(500, 500) <= sizeof(mem),
+          "fixed parse state fits");
+    struct gzl_parse_state *placed = gzl_place_fixed_parse_state(mem, 500, 500);
+
+    size_t piece_lens[] = {len, 4096, 7, 1};
+    for(int i = 0; i < 4; i++) {
+        for(int track_lines = 0; track_lines < 2; track_lines++) {
+            struct gzl_parse_state *state = i % 2 ? placed : s;
+            gzl_init_parse_state(state, &bg);
+            state->track_lines = track_lines;
+            num_terminals = 0;
+            num_allocs = 0;
+            counting = true;
+            bool ok = parse_in_pieces(state, input, len, piece_lens[i]);
+            counting = false;
+            check(ok, "parse succeeds");
+            check(num_terminals > 0, "parse yields terminals");
+            check(num_allocs == 0, "gzl_parse() doesn't allocate");
+        }
+    }
+
+    /* Exceeding the limits of a preallocated state must fail without
+     * allocating. */
+    struct gzl_parse_state *tiny = gzl_alloc_fixed_parse_state(1, 1);
+    gzl_init_parse_state(tiny, &bg);
+    num_allocs = 0;
+    counting = true;
+    enum gzl_status status = gzl_parse(tiny, input, len);
+    counting = false;
+    check(status == GZL_STATUS_RESOURCE_LIMIT_EXCEEDED,
+          "exceeding the stack depth is reported");
+    check(num_allocs == 0, "exceeding the stack depth doesn't allocate");
+
+    /* A stack depth limit allows exactly that many frames: a state limited
+     * to the depth the parses above reached must parse the input, and one
+     * limited to a frame less must not. */
+    struct gzl_parse_state *exact = gzl_alloc_fixed_parse_state(max_depth, 500);
+    gzl_init_parse_state(exact, &bg);
+    check(parse_in_pieces(exact, input, len, len),
+          "a parse at exactly the stack depth limit succeeds");
+    gzl_free_parse_state(exact);
+    if(max_depth > 1) {
+        exact = gzl_alloc_fixed_parse_state(max_depth - 1, 500);
+        gzl_init_parse_state(exact, &bg);
+        check(gzl_parse(exact, input, len) ==
+              GZL_STATUS_RESOURCE_LIMIT_EXCEEDED,
+              "a parse one frame past the stack depth limit fails");
+        gzl_free_parse_state(exact);
+    }
+
+    /* gzl_parse_file_fixed(), with a buffer small enough that the input
+     * takes several reads.  stdio gets a buffer of ours too, so that it has
+     * no reason to allocate one on the first read. */
+    static char stdio_buf[BUFSIZ];
+    static char buf[4096];
+    rewind(file);
+    setvbuf(file, stdio_buf, _IOFBF, sizeof(stdio_buf));
+    gzl_init_parse_state(s, &bg);
+    num_terminals = 0;
+    num_allocs = 0;
+    counting = true;
+    status = gzl_parse_file_fixed(s, file, NULL, buf, sizeof(buf));
+    counting = false;
+    check(status == GZL_STATUS_OK, "gzl_parse_file_fixed() succeeds");
+    check(num_terminals > 0, "gzl_parse_file_fixed() yields terminals");
+    check(num_allocs == 0, "gzl_parse_file_fixed() doesn't allocate");
+
+    fclose(file);
+    gzl_free_parse_state(tiny);
+    gzl_free_parse_state(s);
+    gzl_free_grammar(g);
+
+    if(failures == 0)
+        printf("test_zero_malloc: all tests passed.\n");
+    return failures == 0 ? 0 : 1;
+}
+
+/*
+ * Local Variables:
+ * c-file-style: "bsd"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ * vim:et:sts=4:sw=4
+ */
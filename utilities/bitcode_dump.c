@@ -12,6 +12,7 @@
 *********************************************************************/
 
 #include <gazelle/bc_read_stream.h>
+#include <gazelle/grammar.h>
 
 #include <stdio.h>
 #include <string.h>
@@ -38,7 +39,39 @@ void check_error(struct bc_read_stream *s)
 void usage()
 {
     printf("bitcode_dump: dumps all of the records in a bitcode file\n");
-    printf("Usage: bitcode_dump <bitcode file>\n");
+    printf("Usage: bitcode_dump [--intfa-classes] <bitcode file>\n");
+    printf("\n");
+    printf("  --intfa-classes  Load the file as a compiled Gazelle grammar and\n");
+    printf("                   print the byte equivalence classes of each IntFA.\n");
+}
+
+int dump_intfa_classes(char *filename)
+{
+    struct bc_read_stream *s = bc_rs_open_file(filename);
+    if(!s)
+    {
+        printf("Failed to open bitcode file %s\n", filename);
+        return 1;
+    }
+
+    struct gzl_grammar *g = gzl_load_grammar(s);
+    bc_rs_close_stream(s);
+
+    for(int i = 0; i < g->num_intfas; i++)
+    {
+        struct gzl_intfa *intfa = &g->intfas[i];
+        printf("IntFA %d: %d states, %d transitions, ", i, intfa->num_states,
+               intfa->num_transitions);
+        if(intfa->byte_class)
+            printf("%d byte classes\n", intfa->num_classes);
+        else if(intfa->num_states > GZL_INTFA_NO_TRANSITION)
+            printf("no tables (too many states)\n");
+        else
+            printf("no tables (over budget)\n");
+    }
+
+    gzl_free_grammar(g);
+    return 0;
 }
 
 int main(int argc, char *argv[0])
@@ -51,6 +84,16 @@ int main(int argc, char *argv[0])
         return 1;
     }
 
+    if(strcmp(argv[1], "--intfa-classes") == 0)
+    {
+        if(argc < 3)
+        {
+            usage();
+            return 1;
+        }
+        return dump_intfa_classes(argv[2]);
+    }
+
     struct bc_read_stream *s = bc_rs_open_file(argv[1]);
     if(!s)
     {
@@ -15,6 +15,10 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <gazelle/parse.h>
 
@@ -28,6 +32,7 @@ void usage()
     fprintf(stderr, "\n");
     fprintf(stderr, "  --dump-json    Dump a parse tree in JSON as text is parsed.\n");
     fprintf(stderr, "  --dump-total   When parsing finishes, print the number of bytes parsed.\n");
+    fprintf(stderr, "  --read-ahead   Read the input on a second thread while parsing it.\n");
     fprintf(stderr, "  --help         You're looking at it.\n");
     fprintf(stderr, "\n");
 }
@@ -116,25 +121,27 @@ void terminal_callback(struct gzl_parse_state *parse_state,
     struct gzl_buffer *buffer = (struct gzl_buffer*)parse_state->user_data;
     struct gzlparse_state *user_state = (struct gzlparse_state*)buffer->user_data;
     struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(parse_state->parse_stack);
-    assert(frame->frame_type == GZL_FRAME_TYPE_RTN);
-    struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
+    struct gzl_rtn_transition *transition =
+        gzl_get_frame_rtn_transition(parse_state, frame);
 
     print_newline(user_state, false);
     print_indent(user_state);
 
-    char *terminal_name = get_json_escaped_string(terminal->name, 0);
+    struct gzl_grammar *g = parse_state->bound_grammar->grammar;
+    char *terminal_name = get_json_escaped_string(g->terminal_names[terminal->id], 0);
     int start = terminal->offset.byte - buffer->buf_offset;
     assert(start >= 0);
     assert(start+terminal->len <= buffer->buf_len);
     char *terminal_text = get_json_escaped_string(buffer->buf+
                                                   (terminal->offset.byte - buffer->buf_offset),
                                                   terminal->len);
-    char *slotname = get_json_escaped_string(rtn_frame->rtn_transition->slotname, 0);
+    char *slotname = get_json_escaped_string(transition->slotname, 0);
+    struct gzl_offset offset = terminal->offset;
+    gzl_line_index_lookup(parse_state->line_index, &offset);
     printf("{\"terminal\": %s, \"slotname\": %s, \"slotnum\": %d, \"byte_offset\": %zu, "
            "\"line\": %zu, \"column\": %zu, \"len\": %zu, \"text\": %s}",
-           terminal_name, slotname, rtn_frame->rtn_transition->slotnum,
-           terminal->offset.byte, terminal->offset.line, terminal->offset.column,
-           terminal->len, terminal_text);
+           terminal_name, slotname, transition->slotnum,
+           offset.byte, offset.line, offset.column, terminal->len, terminal_text);
     free(terminal_name);
     free(terminal_text);
     free(slotname);
@@ -145,24 +152,24 @@ void start_rule_callback(struct gzl_parse_state *parse_state)
     struct gzl_buffer *buffer = (struct gzl_buffer*)parse_state->user_data;
     struct gzlparse_state *user_state = (struct gzlparse_state*)buffer->user_data;
     struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(parse_state->parse_stack);
-    assert(frame->frame_type == GZL_FRAME_TYPE_RTN);
-    struct gzl_rtn_frame *rtn_frame = &frame->f.rtn_frame;
 
     print_newline(user_state, false);
     print_indent(user_state);
-    char *rule = get_json_escaped_string(rtn_frame->rtn->name, 0);
+    char *rule = get_json_escaped_string(gzl_get_frame_rtn(parse_state, frame)->name, 0);
+    struct gzl_offset offset = *gzl_get_frame_start_offset(parse_state, frame);
+    gzl_line_index_lookup(parse_state->line_index, &offset);
     printf("{\"rule\":%s, \"start\": %zu, \"line\": %zu, \"column\": %zu, ",
-           rule, frame->start_offset.byte,
-           frame->start_offset.line, frame->start_offset.column);
+           rule, offset.byte, offset.line, offset.column);
     free(rule);
 
     if(parse_state->parse_stack_len > 1)
     {
         frame--;
-        struct gzl_rtn_frame *prev_rtn_frame = &frame->f.rtn_frame;
-        char *slotname = get_json_escaped_string(prev_rtn_frame->rtn_transition->slotname, 0);
+        struct gzl_rtn_transition *prev_transition =
+            gzl_get_frame_rtn_transition(parse_state, frame);
+        char *slotname = get_json_escaped_string(prev_transition->slotname, 0);
         printf("\"slotname\":%s, \"slotnum\":%d, ",
-               slotname, prev_rtn_frame->rtn_transition->slotnum);
+               slotname, prev_transition->slotnum);
         free(slotname);
     }
 
@@ -173,20 +180,25 @@ void start_rule_callback(struct gzl_parse_state *parse_state)
 
 void error_char_callback(struct gzl_parse_state *parse_state, int ch)
 {
+    struct gzl_offset offset = parse_state->offset;
+    if(parse_state->line_index)
+        gzl_line_index_lookup(parse_state->line_index, &offset);
     fprintf(stderr, "gzlparse: unexpected character '%c' (0x%02x) at "
                     "line %zu, column %zu (byte offset %zu), aborting.\n",
-                    ch, ch, parse_state->offset.line, parse_state->offset.column,
-                    parse_state->offset.byte);
+                    ch, ch, offset.line, offset.column, offset.byte);
 }
 
 void error_terminal_callback(struct gzl_parse_state *parse_state, struct gzl_terminal *terminal)
 {
     struct gzl_buffer *buffer = (struct gzl_buffer*)parse_state->user_data;
     struct gzlparse_state *user_state = (struct gzlparse_state*)buffer->user_data;
+    struct gzl_offset offset = terminal->offset;
+    if(parse_state->line_index)
+        gzl_line_index_lookup(parse_state->line_index, &offset);
     fprintf(stderr, "gzlparse: unexpected terminal '%s' at line %zu, column %zu "
                     "(byte offset %zu), aborting.\n",
-                    terminal->name, terminal->offset.line, terminal->offset.column,
-                    terminal->offset.byte);
+                    parse_state->bound_grammar->grammar->terminal_names[terminal->id],
+                    offset.line, offset.column, offset.byte);
     char *terminal_text = get_json_escaped_string(buffer->buf+
                                                   (terminal->offset.byte - buffer->buf_offset),
                                                   terminal->len);
@@ -199,12 +211,12 @@ void end_rule_callback(struct gzl_parse_state *parse_state)
     struct gzl_buffer *buffer = (struct gzl_buffer*)parse_state->user_data;
     struct gzlparse_state *user_state = (struct gzlparse_state*)buffer->user_data;
     struct gzl_parse_stack_frame *frame = DYNARRAY_GET_TOP(parse_state->parse_stack);
-    assert(frame->frame_type == GZL_FRAME_TYPE_RTN);
+    struct gzl_offset *start_offset = gzl_get_frame_start_offset(parse_state, frame);
 
     RESIZE_DYNARRAY(user_state->first_child, user_state->first_child_len-1);
     print_newline(user_state, true);
     print_indent(user_state);
-    printf("], \"len\": %zu}", parse_state->offset.byte - frame->start_offset.byte);
+    printf("], \"len\": %zu}", parse_state->offset.byte - start_offset->byte);
 }
 
 int main(int argc, char *argv[])
@@ -225,12 +237,15 @@ int main(int argc, char *argv[])
     int arg_offset = 1;
     bool dump_json = false;
     bool dump_total = false;
+    bool read_ahead = false;
     while(arg_offset < argc && argv[arg_offset][0] == '-')
     {
         if(strcmp(argv[arg_offset], "--dump-json") == 0)
             dump_json = true;
         else if(strcmp(argv[arg_offset], "--dump-total") == 0)
             dump_total = true;
+        else if(strcmp(argv[arg_offset], "--read-ahead") == 0)
+            read_ahead = true;
         else
         {
             fprintf(stderr, "Unrecognized option '%s'.\n", argv[arg_offset]);
@@ -257,28 +272,47 @@ int main(int argc, char *argv[])
     struct gzl_grammar *g = gzl_load_grammar(s);
     bc_rs_close_stream(s);
 
-    /* Open the input file. */
-    FILE *file;
-    if(strcmp(argv[arg_offset], "-") == 0)
+    /* Open the input file.  Regular files are mapped into memory unless they
+     * are to be read ahead.  stdin and other files that cannot be mapped
+     * (pipes, /dev/stdin, <(...) and the like) are read with read(2) unless
+     * they are to be read ahead. */
+    char *path = argv[arg_offset];
+    bool is_stdin = strcmp(path, "-") == 0;
+    FILE *file = NULL;
+    int fd = -1;
+    struct stat st;
+    if(is_stdin && read_ahead)
     {
         file = stdin;
     }
-    else
+    else if(read_ahead)
     {
-        file = fopen(argv[arg_offset], "r");
+        file = fopen(path, "r");
         if(!file)
         {
-            printf("Couldn't open file '%s' for reading: %s\n\n", argv[2], strerror(errno));
+            printf("Couldn't open file '%s' for reading: %s\n\n", path, strerror(errno));
             usage();
             return 1;
         }
     }
+    else if(is_stdin)
+    {
+        fd = STDIN_FILENO;
+    }
+    else if(stat(path, &st) != 0 || access(path, R_OK) != 0 ||
+            (!S_ISREG(st.st_mode) && (fd = open(path, O_RDONLY)) < 0))
+    {
+        printf("Couldn't open file '%s' for reading: %s\n\n", path, strerror(errno));
+        usage();
+        return 1;
+    }
 
     struct gzlparse_state user_state;
     INIT_DYNARRAY(user_state.first_child, 1, 16);
     user_state.first_child[0] = true;
 
-    struct gzl_parse_state *state = gzl_alloc_parse_state();
+    /* Allocate the stack and token buffer up front, to the default limits. */
+    struct gzl_parse_state *state = gzl_alloc_fixed_parse_state(500, 500);
     struct gzl_bound_grammar bg = {
         .grammar = g,
         .error_char_cb = error_char_callback,
@@ -291,7 +325,40 @@ int main(int argc, char *argv[])
         fputs("{\"parse_tree\":", stdout);
     }
     gzl_init_parse_state(state, &bg);
-    enum gzl_status status = gzl_parse_file(state, file, &user_state, 50 * 1024);
+
+    /* The JSON dump prints line numbers for every offset, so look them up on
+     * demand instead of counting them for every byte.  The index grows with
+     * the number of lines, so it is only kept for a dump; otherwise the
+     * parser tracks lines itself for the error messages. */
+    if(dump_json) {
+        state->track_lines = false;
+        state->line_index = gzl_alloc_line_index();
+    }
+
+    enum gzl_status status;
+    if(file)
+    {
+        status = gzl_parse_file_read_ahead(state, file, &user_state, 50 * 1024);
+    }
+    else if(fd >= 0)
+    {
+        struct gzl_buffer buffer;
+        gzl_init_buffer(&buffer, &user_state);
+        status = gzl_parse_fd(state, fd, &buffer, 50 * 1024);
+        while(status == GZL_STATUS_WOULD_BLOCK)
+        {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            poll(&pfd, 1, -1);
+            status = gzl_parse_fd(state, fd, &buffer, 50 * 1024);
+        }
+        gzl_free_buffer(state, &buffer);
+        if(fd != STDIN_FILENO)
+            close(fd);
+    }
+    else
+    {
+        status = gzl_parse_mmap(state, path, &user_state);
+    }
 
     switch(status)
     {
@@ -318,6 +385,11 @@ int main(int argc, char *argv[])
             /* TODO: when we support length caps. */
             break;
 
+        case GZL_STATUS_PAUSED:
+        case GZL_STATUS_WOULD_BLOCK:
+            /* Pauses are resumed from, and stdin is waited for above. */
+            break;
+
         case GZL_STATUS_RESOURCE_LIMIT_EXCEEDED:
             /* TODO: more informative message about what limit was exceeded. */
             fprintf(stderr, "gzlparse: resource limit exceeded.\n");
@@ -332,10 +404,13 @@ int main(int argc, char *argv[])
             break;
     }
 
+    if(state->line_index)
+        gzl_free_line_index(state->line_index);
     gzl_free_parse_state(state);
     gzl_free_grammar(g);
     FREE_DYNARRAY(user_state.first_child);
-    fclose(file);
+    if(file)
+        fclose(file);
 }
 
 /*